@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include "../toy_eval.h"
+
+// Evaluates 'x + y * 16' (progs/exam00.d) over N argument vectors, once by
+// calling the native function in a loop and once through evalBatch().
+//
+//   ./build/eval_bench [N]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - 
+                                       start).count();
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], 0, 10) : 10000000;
+
+  std::vector<int32_t> args(2 * n), out(n), ref(n);
+  for(size_t idx = 0; idx < 2 * n; idx++)
+    args[idx] = rand() % 1000;
+
+  std::chrono::steady_clock::time_point start = 
+      std::chrono::steady_clock::now();
+  CompiledFunction F;
+  try {
+    F = compileExpression("x + y * 16", {"x", "y"});
+  } catch(CompileError &E) {
+    printf("%s", E.what());
+    return 1;
+  }
+  printf("compile:    %8.3f ms\n", seconds_since(start) * 1e3);
+
+  int32_t (*foo)(int32_t, int32_t) = F.get<int32_t, int32_t>();
+  start = std::chrono::steady_clock::now();
+  for(size_t idx = 0; idx < n; idx++)
+    ref[idx] = foo(args[2 * idx], args[2 * idx + 1]);
+  double call_time = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  F.evalBatch(args.data(), out.data(), n);
+  double batch_time = seconds_since(start);
+
+  printf("call loop:  %8.3f ms, %6.2f ns/eval\n", call_time * 1e3, 
+         call_time * 1e9 / n);
+  printf("evalBatch:  %8.3f ms, %6.2f ns/eval\n", batch_time * 1e3, 
+         batch_time * 1e9 / n);
+  printf("results %s\n", out == ref ? "match" : "DIFFER");
+  return out == ref ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../toy_eval.h"
+#include "../toy_interp.h"
+
+// Time to first result of small scripts: interpreter against the JIT at
+// -O0 and -O2, from source text to the values of the top-level expressions.
+// The first JIT run includes the one-time LLVM target initialization.
+//
+//   ./build/interp_bench [repetitions]
+
+struct Script {
+  const char *Name;
+  const char *Source;
+};
+
+static const Script Scripts[] = {
+  {"exam00 call", "def foo (x, y)\n  x + y * 16\nfoo(5, 6)\n"},
+  {"loop", "def sum(n)\n  for i = 1, i < n, 1 in\n    i * i\nsum(1000)\n"},
+  {"fib(15)", "def fib(x)\n  if x < 3 then\n    1\n  else\n"
+              "    fib(x-1)+fib(x-2)\nfib(15)\n"},
+  {"fib(27)", "def fib(x)\n  if x < 3 then\n    1\n  else\n"
+              "    fib(x-1)+fib(x-2)\nfib(27)\n"},
+};
+
+typedef std::vector<int32_t> (*Runner)(const char *, size_t);
+
+static std::vector<int32_t> run_interp(const char *buf, size_t len) {
+  return interpretTopLevel(buf, len);
+}
+
+static std::vector<int32_t> run_jit_O0(const char *buf, size_t len) {
+  return evalTopLevel(buf, len, 0);
+}
+
+static std::vector<int32_t> run_jit_O2(const char *buf, size_t len) {
+  return evalTopLevel(buf, len, 2);
+}
+
+// Returns the fastest of 'reps' runs in microseconds.
+static double time_runs(Runner run, const std::string &source, int reps,
+                        std::vector<int32_t> &results) {
+  double best = 1e30;
+  for(int rep = 0; rep < reps; rep++) {
+    std::chrono::steady_clock::time_point start = 
+        std::chrono::steady_clock::now();
+    results = run(source.data(), source.size());
+    double elapsed = std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - start).count();
+    if(elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  int reps = argc > 1 ? atoi(argv[1]) : 10;
+
+  std::vector<int32_t> first;
+  std::string warmup = Scripts[0].Source;
+  double cold = time_runs(run_jit_O0, warmup, 1, first);
+  printf("first JIT run (cold): %10.1f us\n\n", cold);
+
+  printf("%-12s %12s %12s %12s\n", "script", "interp us", "jit -O0 us", 
+         "jit -O2 us");
+  for(size_t idx = 0; idx < sizeof(Scripts) / sizeof(Scripts[0]); idx++) {
+    std::string source = Scripts[idx].Source;
+    std::vector<int32_t> interp_res, o0_res, o2_res;
+    try {
+      double interp = time_runs(run_interp, source, reps, interp_res);
+      double o0 = time_runs(run_jit_O0, source, reps, o0_res);
+      double o2 = time_runs(run_jit_O2, source, reps, o2_res);
+      printf("%-12s %12.1f %12.1f %12.1f%s\n", Scripts[idx].Name, interp, o0,
+             o2, interp_res == o0_res && o0_res == o2_res ? "" : "  DIFFER");
+    } catch(CompileError &E) {
+      printf("%-12s %s", Scripts[idx].Name, E.what());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include "../toy_eval.h"
+
+// Evaluates a toy function with an if-expression over N elements, once by
+// calling the scalar function in a loop and once through the vectorized
+// kernel from compileKernel().
+//
+//   ./build/kernel_bench [N]
+
+static const char *Source = 
+    "def absdiff(x, y)\n"
+    "  if x < y then\n"
+    "    (y - x) * 3\n"
+    "  else\n"
+    "    x - y + 7\n";
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - 
+                                       start).count();
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], 0, 10) : 10000000;
+
+  std::vector<int32_t> x(n), y(n), out(n), ref(n);
+  for(size_t idx = 0; idx < n; idx++) {
+    x[idx] = rand() % 1000;
+    y[idx] = rand() % 1000;
+  }
+
+  CompiledFunction Scalar, Vec;
+  try {
+    Scalar = compileFunction(Source, "absdiff");
+    Vec = compileKernel(Source, "absdiff");
+  } catch(CompileError &E) {
+    printf("%s", E.what());
+    return 1;
+  }
+
+  int32_t (*absdiff)(int32_t, int32_t) = Scalar.get<int32_t, int32_t>();
+  std::chrono::steady_clock::time_point start = 
+      std::chrono::steady_clock::now();
+  for(size_t idx = 0; idx < n; idx++)
+    ref[idx] = absdiff(x[idx], y[idx]);
+  double scalar_time = seconds_since(start);
+
+  void (*absdiff_vec)(const int32_t *, const int32_t *, int32_t *, size_t) = 
+      Vec.getKernel<int32_t, int32_t>();
+  start = std::chrono::steady_clock::now();
+  absdiff_vec(x.data(), y.data(), out.data(), n);
+  double vec_time = seconds_since(start);
+
+  printf("scalar loop: %8.3f ms, %6.3f ns/elem\n", scalar_time * 1e3, 
+         scalar_time * 1e9 / n);
+  printf("kernel:      %8.3f ms, %6.3f ns/elem (%.1fx)\n", vec_time * 1e3, 
+         vec_time * 1e9 / n, scalar_time / vec_time);
+  printf("results %s\n", out == ref ? "match" : "DIFFER");
+  return out == ref ? 0 : 1;
+}
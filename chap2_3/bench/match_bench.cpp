@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+
+#include "../toy.h"
+
+// Dispatch over NCASES values: a match, which becomes one switch, against
+// the same if-else chain of equality tests with the switch conversion of
+// the parser turned off, each at -O0 and -O2. The arguments are spread
+// over the cases and a few values that hit none.
+//
+//   ./build/match_bench [calls]
+
+static const int NCASES = 160;
+
+static std::string make_source(bool chain) {
+  std::string Source = "def dispatch(x)\n";
+  for(int idx = 0; idx < NCASES; idx++) {
+    std::string Body = "x * " + std::to_string(idx % 13 + 2) + " + " +
+                       std::to_string(idx * 7);
+    if(chain) {
+      Source += (idx ? "  else if x = " : "  if x = ") +
+                std::to_string(idx * 3) + " then " + Body + "\n";
+    } else {
+      Source += (idx ? "  | " : "  match x with ") +
+                std::to_string(idx * 3) + " -> " + Body + "\n";
+    }
+  }
+  Source += chain ? "  else x\n" : "  | _ -> x\n";
+  return Source;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start).count();
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], 0, 10) : 10000000;
+
+  std::vector<int32_t> args(n);
+  for(size_t idx = 0; idx < n; idx++)
+    args[idx] = rand() % (NCASES * 3 + 16);
+
+  int64_t expected = 0;
+  for(unsigned OptLevel = 0; OptLevel <= 2; OptLevel += 2) {
+    for(int chain = 0; chain <= 1; chain++) {
+      std::string Source = make_source(chain);
+      CompilerInstance CI;
+      CI.SwitchConversion = false;
+      int32_t (*dispatch)(int32_t);
+      try {
+        CI.compileBuffer(Source.data(), Source.size());
+        llvm::ExecutionEngine *EE = CI.createEngine();
+        if(OptLevel)
+          CI.optimize(OptLevel);
+        dispatch = (int32_t (*)(int32_t))EE->getFunctionAddress("dispatch");
+      } catch(CompileError &E) {
+        printf("%s", E.what());
+        return 1;
+      }
+
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      int64_t sum = 0;
+      for(size_t idx = 0; idx < n; idx++)
+        sum += dispatch(args[idx]);
+      double secs = seconds_since(start);
+      if(OptLevel == 0 && !chain)
+        expected = sum;
+
+      printf("-O%u %-9s %8.3f ms, %6.3f ns/call%s\n", OptLevel,
+             chain ? "if chain:" : "match:", secs * 1e3, secs * 1e9 / n,
+             sum == expected ? "" : "  MISMATCH");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../toy.h"
+#include "../toy_ast.h"
+
+// Parses a generated source of N functions (about 100 bytes each) with
+// 1, 2, 4, ... threads up to the number of cores and prints the front-end
+// throughput.
+//
+//   ./build/parse_bench [N]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - 
+                                       start).count();
+}
+
+static std::string generate(size_t n) {
+  std::string source = "# generated\ndef binary| 5 (a b)\n  a + b\n";
+  for(size_t idx = 0; idx < n; idx++) {
+    std::string name = "f" + std::to_string(idx);
+    source += "def " + name + "(x, y)\n";
+    source += "  if x < y then (x * 3 | y) - 7 else\n";
+    source += "    for i = 1, i < y, 1 in x + i * 2\n";
+    if(idx % 100 == 0)
+      source += name + "(1, 2) | 4\n";
+  }
+  return source;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], 0, 10) : 200000;
+  std::string source = generate(n);
+  printf("%.1f MB, %zu functions\n", source.size() / 1e6, n);
+
+  unsigned cores = std::thread::hardware_concurrency();
+  size_t expected = 0;
+  for(unsigned threads = 1; threads <= (cores > 4 ? cores : 4); 
+      threads *= 2) {
+    CompilerInstance CI;
+    std::chrono::steady_clock::time_point start = 
+        std::chrono::steady_clock::now();
+    std::vector<FunctionDefnAST *> Defns;
+    try {
+      Defns = CI.parseBuffer(source.data(), source.size(), threads);
+    } catch(CompileError &E) {
+      printf("%s", E.what());
+      return 1;
+    }
+    double secs = seconds_since(start);
+    if(threads == 1)
+      expected = Defns.size();
+
+    printf("%2u threads: %8.3f ms %8.1f MB/s%s\n", threads, secs * 1e3, 
+           source.size() / 1e6 / secs, 
+           Defns.size() == expected ? "" : "  MISMATCH");
+    delete_defns(Defns);
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+
+#include "../toy_eval.h"
+#include "../toy_runtime.h"
+
+// Runs a 'parallel for' over N iterations of uneven cost (a recursive fib
+// of 10 to 24) on pools of 1, 2, 4, ... threads up to the number of cores
+// and prints the speedup over the single thread, which runs the loop right
+// away without the runtime.
+//
+//   ./build/pfor_bench [N]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start).count();
+}
+
+static const char *Source =
+    "def fib(x)\n"
+    "  if x < 3 then 1 else fib(x - 1) + fib(x - 2)\n"
+    "def psum(n)\n"
+    "  parallel for i = 0, n in fib(10 + i * 7 / 5 - i * 7 / 5 / 15 * 15)\n";
+
+int main(int argc, char **argv) {
+  int32_t n = argc > 1 ? strtol(argv[1], 0, 10) : 20000;
+
+  CompiledFunction F;
+  try {
+    F = compileFunction(Source, "psum");
+  } catch(CompileError &E) {
+    printf("%s", E.what());
+    return 1;
+  }
+  int32_t (*psum)(int32_t) = F.get<int32_t>();
+
+  unsigned cores = std::thread::hardware_concurrency();
+  double base = 0;
+  int32_t expected = 0;
+  for(unsigned threads = 1; threads <= (cores > 4 ? cores : 4);
+      threads *= 2) {
+    toy_runtime_set_threads(threads);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    int32_t result = psum(n);
+    double secs = seconds_since(start);
+    if(threads == 1) {
+      base = secs;
+      expected = result;
+    }
+
+    printf("%2u threads: %8.3f ms, speedup %5.2fx%s\n", threads, secs * 1e3,
+           base / secs, result == expected ? "" : "  MISMATCH");
+  }
+  return 0;
+}
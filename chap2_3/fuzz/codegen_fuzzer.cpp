@@ -0,0 +1,24 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "../toy.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  Lexer lex((const char *)data, size);
+  CompilerInstance CI;
+  llvm::Module *M;
+  try {
+    M = CI.compile(lex);
+  } catch(CompileError &) {
+    return 0;
+  }
+
+  // any input that compiles has to give valid IR
+  if(llvm::verifyModule(*M, &llvm::errs()))
+    abort();
+  return 0;
+}
@@ -0,0 +1,11 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../toy.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  Lexer lex((const char *)data, size);
+  while(lex.next_token() != EOF_TOKEN)
+    ;
+  return 0;
+}
@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../toy.h"
+#include "../toy_ast.h"
+
+// Parses the input once in one piece and once cut at the top-level defs,
+// both must give the same functions or the same error.
+static std::string parse_summary(const uint8_t *data, size_t size,
+                                 unsigned Threads) {
+  CompilerInstance CI;
+  std::string summary;
+  try {
+    std::vector<FunctionDefnAST *> Defns;
+    if(Threads == 0) {
+      Lexer lex((const char *)data, size);
+      Defns = CI.parse(lex);
+    } else {
+      Defns = CI.parseBuffer((const char *)data, size, Threads);
+    }
+    for(size_t idx = 0; idx < Defns.size(); idx++)
+      summary += Defns[idx]->getDecl()->getName() + "\n";
+    delete_defns(Defns);
+  } catch(CompileError &E) {
+    summary = E.what();
+  }
+  return summary;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if(parse_summary(data, size, 0) != parse_summary(data, size, 3))
+    abort();
+  return 0;
+}
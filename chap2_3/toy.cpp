@@ -1,249 +1,222 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
+#include <exception>
+#include <algorithm>
 #include <iostream>
+#include <set>
+#include <thread>
 #include <string>
 #include <vector>
 #include <map>
 
 #include <llvm-c/Core.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "toy.h"
+#include "toy_ast.h"
+#include "toy_runtime.h"
 
 using namespace llvm;
 
-// some static variables
-static LLVMContext context;
-static Module *Module_ob;
-static IRBuilder<> Builder(context);
-static std::map<std::string, Value*> Named_Values;
-static ExecutionEngine *TheEngine;
-
-enum Token_Type {
-  EOF_TOKEN = 0,
-  NUMERIC_TOKEN,
-  IDENTIFIER_TOKEN,
-  LPARAN_TOKEN,
-  RPARAN_TOKEN,
-  DEF_TOKEN,
-  COMM_TOKEN,
-  COMMENT_TOKEN,
-  IF_TOKEN,
-  THEN_TOKEN,
-  ELSE_TOKEN,
-  FOR_TOKEN,
-  IN_TOKEN,
-  UNARY_TOKEN,
-  BINARY_TOKEN
-};
-
 void check_cond(bool cond, std::string message) {
   if (!cond) {
-    printf("%s", message.c_str());
-    exit(0);
+    throw CompileError(message);
   }
   return;
 }
 
-class BaseAST
-{
-public:
-  BaseAST(){}; 
-  virtual ~BaseAST(){};
-
-  virtual Value *code_gen() = 0;
-};
+static std::map<int, std::string> assign_dump_str();
+static const std::map<int, std::string> dump_str = assign_dump_str();
 
-static int Numeric_Val;
-static std::string Identifier_string;
-static FILE *file;
-static int LastChar = ' ';
-static int Current_token;
-static std::map<char, int> OperatorPrece;
-static std::map<int, std::string> dump_str;
-
-// declaration of parser functions
-static BaseAST *numeric_parser();
-static BaseAST *identifier_parser();
-static BaseAST *expression_parser();
-static BaseAST *paran_parser();
-static BaseAST *Base_Parser();
-static BaseAST *binary_op_parser(int Old_prec, BaseAST *LHS);
-
-static void init_precedence();
-static int getBinOpPrecedence();
-static void Driver();
-
-class VariableAST: public BaseAST
-{
-  std::string Var_Name;
-public:
-  VariableAST(std::string &name): Var_Name(name)
-  {
-  }
-  ~VariableAST()
-  {
-#ifdef DUMP_AST
-    std::cout << "VariableAST: " << Var_Name << std::endl;
-#endif
-  }
-
-  virtual Value *code_gen();
-};
-
-Value *VariableAST::code_gen()
+Value *VariableAST::code_gen(CompilerInstance &CI)
 {
 #ifdef DUMP_CG
   std::cout << "VariableAST CG: " << Var_Name << std::endl;
 #endif
-  Value *V = Named_Values[Var_Name];
-  return V ? V : 0;
+  Value *V = CI.Named_Values[Var_Name];
+  check_cond(V != 0, "Error: unknown variable " + Var_Name + "!\n");
+  return V;
 }
 
-class NumericAST: public BaseAST
-{
-  int numeric_val;
-public:
-  NumericAST(int val): numeric_val(val)
-  {
-  }
-  ~NumericAST()
-  {
-#ifdef DUMP_AST
-    std::cout << "NumericAST: " << numeric_val << std::endl;
-#endif
-  }
-
-  virtual Value *code_gen();
-};
-
-Value *NumericAST::code_gen()
+Value *NumericAST::code_gen(CompilerInstance &CI)
 {
 #ifdef DUMP_CG
   std::cout << "NumericAST CG: " << numeric_val << std::endl;
 #endif
-  return ConstantInt::get(Type::getInt32Ty(context), numeric_val);
+  return ConstantInt::get(Type::getInt32Ty(CI.context), numeric_val);
 }
 
-class BinaryAST: public BaseAST
-{
-  std::string Bin_Operator;
-  BaseAST *LHS, *RHS;
-
-public:
-  BinaryAST(std::string op, BaseAST *lhs, BaseAST *rhs): 
-  Bin_Operator(op), LHS(lhs), RHS(rhs)
-  {
-  }
-
-  ~BinaryAST()
-  {
-    if(LHS)
-      delete LHS;
-    if(RHS)
-      delete RHS;
-#ifdef DUMP_AST
-    printf("BinaryAST\n");
-#endif
+BinaryAST::BinaryAST(std::string op, BaseAST *lhs, BaseAST *rhs)
+    : Bin_Operator(op), LHS(lhs), RHS(rhs), Pure(false) {
+  // user operators are calls
+  switch(atoi(Bin_Operator.c_str())) {
+    case '<':
+    case '=':
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+      Pure = LHS->isPure() && RHS->isPure();
+      break;
+    default:
+      break;
   }
-  virtual Value *code_gen();
-};
-
-Value *BinaryAST::code_gen() {
-#ifdef DUMP_CG
-  std::cout << "BinaryAST CG: " << std::endl;
-#endif
-  Value *L = LHS->code_gen();
-  Value *R = RHS->code_gen();
+}
 
-  if(L == 0 || R == 0) {
-    printf("Error in codegen of binary ast, no lhs or rhs!\n");
-    exit(0);
+bool BinaryAST::isSpeculatable() const {
+  // '/' may divide by zero and user operators are calls
+  switch(atoi(Bin_Operator.c_str())) {
+    case '<':
+    case '=':
+    case '+':
+    case '-':
+    case '*':
+      return LHS->isSpeculatable() && RHS->isSpeculatable();
+    default:
+      return false;
   }
+}
 
+void BinaryAST::collectCallees(std::vector<std::string> &Callees) const {
+  // nothing below a pure node calls, this also keeps shared nodes from
+  // being walked over and over
+  if(Pure)
+    return;
+  LHS->collectCallees(Callees);
+  RHS->collectCallees(Callees);
   switch(atoi(Bin_Operator.c_str())) {
     case '<':
-      L = Builder.CreateICmpULT(L, R, "cmptmp");
-      return Builder.CreateZExt(L, Type::getInt32Ty(context), "booltmp");
+    case '=':
     case '+':
-      return Builder.CreateAdd(L, R, "addtmp");
     case '-':
-      return Builder.CreateSub(L, R, "subtmp");
     case '*':
-      return Builder.CreateMul(L, R, "multmp");
     case '/':
-      return Builder.CreateUDiv(L, R, "divtmp");
-    default:
       break;
+    default:
+      Callees.push_back(std::string("binary") + 
+                        (char)atoi(Bin_Operator.c_str()));
   }
+}
 
-  Function *F = Module_ob->getFunction(std::string("binary") + Bin_Operator);
-  Value *Ops[2] = {L, R};
-  return Builder.CreateCall(F, Ops, "binop");
-}
-
-class FunctionDeclAST: public BaseAST {
-  std::string Func_name;
-  std::vector<std::string> Arguments;
-  bool isOperator;
-  unsigned Precedence;
-
-public:
-  FunctionDeclAST(const std::string &name, 
-                  const std::vector<std::string> &args,
-                  bool isoperator = false,
-                  unsigned prec = 0)
-      : Func_name(name), Arguments(args), 
-        isOperator(isoperator), Precedence(prec) {}
-
-  ~FunctionDeclAST() {
-#ifdef DUMP_AST
-    std::cout << "FunctionDeclAST: " << Func_name << std::endl;
-#endif
+bool BinaryAST::isEquality(BaseAST *&Subject, int &Val) const {
+  if(atoi(Bin_Operator.c_str()) != '=')
+    return false;
+  if(RHS->getNumber(Val)) {
+    Subject = LHS;
+    return true;
   }
-
-  bool isUnaryOp() const {
-    return isOperator && Arguments.size() == 1;
+  if(LHS->getNumber(Val)) {
+    Subject = RHS;
+    return true;
   }
+  return false;
+}
 
-  bool isBinaryOp() const {
-    return isOperator && Arguments.size() == 2;
+Value *BinaryAST::code_gen(CompilerInstance &CI) {
+#ifdef DUMP_CG
+  std::cout << "BinaryAST CG: " << std::endl;
+#endif
+  // a shared node is generated once per block
+  std::pair<BasicBlock *, BaseAST *> Key(CI.Builder.GetInsertBlock(), this);
+  if(Pure) {
+    std::map<std::pair<BasicBlock *, BaseAST *>, Value *>::iterator it = 
+        CI.Expr_Values.find(Key);
+    if(it != CI.Expr_Values.end())
+      return it->second;
   }
 
-  char getOperatorName() const {
-    assert(isUnaryOp() || isBinaryOp());
-    return Func_name[Func_name.size() - 1];
-  }
+  Value *L = LHS->code_gen(CI);
+  Value *R = RHS->code_gen(CI);
 
-  unsigned getBinaryPrecedence() const {
-    return Precedence;
+  check_cond(L != 0 && R != 0, 
+             "Error in codegen of binary ast, no lhs or rhs!\n");
+
+  CI.emitLocation(this);
+  Value *Result = 0;
+  switch(atoi(Bin_Operator.c_str())) {
+    case '<':
+      L = CI.Builder.CreateICmpULT(L, R, "cmptmp");
+      Result = CI.Builder.CreateZExt(L, Type::getInt32Ty(CI.context), 
+                                     "booltmp");
+      break;
+    case '=':
+      L = CI.Builder.CreateICmpEQ(L, R, "cmptmp");
+      Result = CI.Builder.CreateZExt(L, Type::getInt32Ty(CI.context), 
+                                     "booltmp");
+      break;
+    case '+':
+      Result = CI.Builder.CreateAdd(L, R, "addtmp");
+      break;
+    case '-':
+      Result = CI.Builder.CreateSub(L, R, "subtmp");
+      break;
+    case '*':
+      Result = CI.Builder.CreateMul(L, R, "multmp");
+      break;
+    case '/':
+      Result = CI.Builder.CreateUDiv(L, R, "divtmp");
+      break;
+    default:
+      break;
+  }
+  if(Result) {
+    if(Pure)
+      CI.Expr_Values[Key] = Result;
+    return Result;
   }
 
-  virtual Value *code_gen();
-};
+  Function *F = CI.Module_ob->getFunction(
+      std::string("binary") + (char)atoi(Bin_Operator.c_str()));
+  check_cond(F != 0, "Error: unknown binary operator!\n");
+  Value *Ops[2] = {L, R};
+  return CI.Builder.CreateCall(F, Ops, "binop");
+}
 
-Value *FunctionDeclAST::code_gen()
+Value *FunctionDeclAST::code_gen(CompilerInstance &CI)
 {
 #ifdef DUMP_CG
   std::cout << "FunctionDeclAST CG: " << std::endl;
 #endif
-  std::vector<Type *> Integers(Arguments.size(), Type::getInt32Ty(context));
-  FunctionType *FT = FunctionType::get(Type::getInt32Ty(context), 
+  std::vector<Type *> Integers(Arguments.size(), Type::getInt32Ty(CI.context));
+  FunctionType *FT = FunctionType::get(Type::getInt32Ty(CI.context), 
                                        Integers, false);
   Function *F = Function::Create(FT, Function::ExternalLinkage, 
-                                 Func_name, Module_ob);
+                                 Func_name, CI.Module_ob);
 
   if(F->getName() != Func_name)
   {
     F->eraseFromParent();
-    F = Module_ob->getFunction(Func_name);
+    F = CI.Module_ob->getFunction(Func_name);
 
-    if(F->empty())  return 0;
-    if(F->arg_size() != Arguments.size()) return 0;
+    check_cond(F->empty(), 
+               "Error: redefinition of function " + Func_name + "!\n");
+    check_cond(F->arg_size() == Arguments.size(), 
+               "Error: redefinition of function " + Func_name + 
+               " with a different number of arguments!\n");
   }
 
   unsigned idx = 0;
@@ -251,53 +224,32 @@ Value *FunctionDeclAST::code_gen()
       ++arg_it, ++idx)
   {
     arg_it->setName(Arguments[idx]);
-    Named_Values[Arguments[idx]] = &(*arg_it);
+    CI.Named_Values[Arguments[idx]] = &(*arg_it);
   }
   return F;
 }
 
-class FunctionDefnAST: public BaseAST {
-  FunctionDeclAST *Func_Decl;
-  BaseAST *Body;
-  
-public:
-  FunctionDefnAST(FunctionDeclAST *proto, BaseAST *body): 
-  Func_Decl(proto), Body(body)
-  {
-  }
-
-  ~FunctionDefnAST()
-  {
-    if(Func_Decl)
-      delete Func_Decl;
-    if(Body)
-      delete Body;
-#ifdef DUMP_AST
-    printf("FunctionDefnAST\n");
-#endif
-  }
-  virtual Value *code_gen();
-};
-
-Value *FunctionDefnAST::code_gen()
+Value *FunctionDefnAST::code_gen(CompilerInstance &CI)
 {
 #ifdef DUMP_CG
   std::cout << "FunctionDefnAST CG: " << std::endl;
 #endif
-  Named_Values.clear();
-  Function *theFunction = (Function *)(Func_Decl->code_gen());
+  CI.Named_Values.clear();
+  CI.Expr_Values.clear();
+  Function *theFunction = (Function *)(Func_Decl->code_gen(CI));
   if(theFunction == 0)
     return 0;
   if (Func_Decl->isBinaryOp()) {
-    OperatorPrece[Func_Decl->getOperatorName()] = 
+    CI.OperatorPrece[Func_Decl->getOperatorName()] = 
         Func_Decl->getBinaryPrecedence();
   }
 
-  BasicBlock *BB_begin = BasicBlock::Create(context, "entry", theFunction);
-  Builder.SetInsertPoint(BB_begin);
+  BasicBlock *BB_begin = BasicBlock::Create(CI.context, "entry", theFunction);
+  CI.Builder.SetInsertPoint(BB_begin);
+  CI.beginDebugFunction(theFunction, getLine());
 
-  if(Value *retVal = Body->code_gen()) {
-    Builder.CreateRet(retVal);
+  if(Value *retVal = Body->code_gen(CI)) {
+    CI.Builder.CreateRet(retVal);
     verifyFunction(*theFunction);
 
     return theFunction;
@@ -307,174 +259,410 @@ Value *FunctionDefnAST::code_gen()
   return 0;
 }
 
-class FunctionCallAST: public BaseAST
-{
-  std::string Function_Callee;
-  std::vector<BaseAST *> Function_Arguments;
-
-public:
-  FunctionCallAST(const std::string &callee, std::vector<BaseAST *> &args)
-      : Function_Callee(callee), Function_Arguments(args) {
-  }
-
-  ~FunctionCallAST() {
-    size_t len = Function_Arguments.size();
-    for(size_t idx = 0; idx < len; idx++) {
-      if(Function_Arguments[idx]) {
-	delete Function_Arguments[idx];
-      }
-    }
-#ifdef DUMP_AST
-    printf("FunctionCallAST\n");
-#endif
-  }
-  virtual Value *code_gen();
-};
-
-Value *FunctionCallAST::code_gen() {
+Value *FunctionCallAST::code_gen(CompilerInstance &CI) {
 #ifdef DUMP_CG
   std::cout << "FunctionCallAST CG: " << std::endl;
 #endif
-  Function *callee_f = Module_ob->getFunction(Function_Callee);
+  Function *callee_f = CI.Module_ob->getFunction(Function_Callee);
   std::vector<Value *> ArgsV;
 
   for(unsigned i = 0, e = Function_Arguments.size(); i != e; ++i) {
-    ArgsV.push_back(Function_Arguments[i]->code_gen());
+    ArgsV.push_back(Function_Arguments[i]->code_gen(CI));
     if(ArgsV.back() == 0)
       return 0;
   }
 
+  CI.emitLocation(this);
   if(callee_f == NULL) {
     std::vector<Type *> Integers(Function_Arguments.size(), 
-                                 Type::getInt32Ty(context));
-    FunctionType *FT = FunctionType::get(Type::getInt32Ty(context), 
+                                 Type::getInt32Ty(CI.context));
+    FunctionType *FT = FunctionType::get(Type::getInt32Ty(CI.context), 
                                          Integers, false);
-    Constant *func_tmp = Module_ob->getOrInsertFunction("calltmp", FT);
+    Constant *func_tmp = CI.Module_ob->getOrInsertFunction("calltmp", FT);
 
-    return Builder.CreateCall(func_tmp, ArgsV);
+    return CI.Builder.CreateCall(func_tmp, ArgsV);
+  }
+  else {
+    check_cond(callee_f->arg_size() == ArgsV.size(), 
+               "Error: wrong number of arguments to " + Function_Callee + 
+               "!\n");
+    return CI.Builder.CreateCall(callee_f, ArgsV, "calltmp");
   }
-  else
-    return Builder.CreateCall(callee_f, ArgsV, "calltmp");
 }
 
-class ExprIfAST : public BaseAST {
-  BaseAST *Cond, *Then, *Else;
-
-public:
-  ExprIfAST(BaseAST *cond, BaseAST *then, BaseAST *else_st)
-      : Cond(cond), Then(then), Else(else_st) {}
-  virtual Value *code_gen();
-};
-
-Value *ExprIfAST::code_gen() {
-  Value *cond_tn = Cond->code_gen();
+Value *ExprIfAST::code_gen(CompilerInstance &CI) {
+  Value *cond_tn = Cond->code_gen(CI);
   if (cond_tn == 0)
     return 0;
-  cond_tn = Builder.CreateICmpNE(cond_tn, Builder.getInt32(0), "ifcond");
+  CI.emitLocation(this);
+  cond_tn = CI.Builder.CreateICmpNE(cond_tn, CI.Builder.getInt32(0), "ifcond");
+
+  // if-conversion: both arms are evaluated and the result is selected
+  if (CI.IfConversion && Then->isSpeculatable() && Else->isSpeculatable()) {
+    Value *ThenVal = Then->code_gen(CI);
+    Value *ElseVal = Else->code_gen(CI);
+    return CI.Builder.CreateSelect(cond_tn, ThenVal, ElseVal, "iftmp");
+  }
 
-  Function *TheFunc = Builder.GetInsertBlock()->getParent();
-  BasicBlock *ThenBB = BasicBlock::Create(context, "then", TheFunc);
-  BasicBlock *ElseBB = BasicBlock::Create(context, "else");
-  BasicBlock *MergeBB = BasicBlock::Create(context, "ifcont");
+  Function *TheFunc = CI.Builder.GetInsertBlock()->getParent();
+  BasicBlock *ThenBB = BasicBlock::Create(CI.context, "then", TheFunc);
+  BasicBlock *ElseBB = BasicBlock::Create(CI.context, "else");
+  BasicBlock *MergeBB = BasicBlock::Create(CI.context, "ifcont");
 
-  Builder.CreateCondBr(cond_tn, ThenBB, ElseBB);
+  CI.Builder.CreateCondBr(cond_tn, ThenBB, ElseBB);
 
-  Builder.SetInsertPoint(ThenBB);
-  Value *ThenVal = Then->code_gen();
+  CI.Builder.SetInsertPoint(ThenBB);
+  Value *ThenVal = Then->code_gen(CI);
   if (ThenVal == 0)
     return 0;
-  Builder.CreateBr(MergeBB);
-  ThenBB = Builder.GetInsertBlock();  
+  CI.Builder.CreateBr(MergeBB);
+  ThenBB = CI.Builder.GetInsertBlock();  
 
   TheFunc->getBasicBlockList().push_back(ElseBB);
-  Builder.SetInsertPoint(ElseBB);
-  Value *ElseVal = Else->code_gen();
+  CI.Builder.SetInsertPoint(ElseBB);
+  Value *ElseVal = Else->code_gen(CI);
   if (ElseVal == 0)
     return 0;
-  Builder.CreateBr(MergeBB);
-  ElseBB = Builder.GetInsertBlock();
+  CI.Builder.CreateBr(MergeBB);
+  ElseBB = CI.Builder.GetInsertBlock();
 
   TheFunc->getBasicBlockList().push_back(MergeBB);
-  Builder.SetInsertPoint(MergeBB);
-  PHINode *Phi = Builder.CreatePHI(Type::getInt32Ty(context), 2, "iftmp");
+  CI.Builder.SetInsertPoint(MergeBB);
+  PHINode *Phi = CI.Builder.CreatePHI(Type::getInt32Ty(CI.context), 2, "iftmp");
   Phi->addIncoming(ThenVal, ThenBB);
   Phi->addIncoming(ElseVal, ElseBB);
 
   return Phi;
 }
 
-class ExprForAST : public BaseAST {
-  std::string Var_Name;
-  BaseAST *Start, *End, *Step, *Body;
+void ExprMatchAST::prependCase(int Val, BaseAST *Body) {
+  for(size_t idx = 0; idx < Cases.size(); idx++) {
+    if(Cases[idx].first == Val) {
+      release(Cases[idx].second);
+      Cases.erase(Cases.begin() + idx);
+      break;
+    }
+  }
+  Cases.insert(Cases.begin(), std::make_pair(Val, Body));
+}
 
-public:
-  ExprForAST(const std::string &varname, BaseAST *start, BaseAST *end,
-             BaseAST *step, BaseAST *body)
-      : Var_Name(varname), Start(start), End(end), Step(step), Body(body) {}
-  Value *code_gen() override;
-};
+bool ExprMatchAST::isSpeculatable() const {
+  if(!Subject->isSpeculatable() || (Default && !Default->isSpeculatable()))
+    return false;
+  for(size_t idx = 0; idx < Cases.size(); idx++)
+    if(!Cases[idx].second->isSpeculatable())
+      return false;
+  return true;
+}
+
+Value *ExprMatchAST::code_gen(CompilerInstance &CI) {
+  Value *SubjectVal = Subject->code_gen(CI);
+  check_cond(SubjectVal != 0, "Error in code gen for subject of match!\n");
+  CI.emitLocation(this);
+
+  // if-conversion: a chain of selects, the first case outermost
+  if (CI.IfConversion && isSpeculatable()) {
+    Value *Result = Default ? Default->code_gen(CI) : CI.Builder.getInt32(0);
+    for(size_t idx = Cases.size(); idx-- > 0; ) {
+      Value *CaseVal = Cases[idx].second->code_gen(CI);
+      Value *Cond = CI.Builder.CreateICmpEQ(
+          SubjectVal, CI.Builder.getInt32(Cases[idx].first), "matchcond");
+      Result = CI.Builder.CreateSelect(Cond, CaseVal, Result, "matchtmp");
+    }
+    return Result;
+  }
+
+  Function *TheFunc = CI.Builder.GetInsertBlock()->getParent();
+  BasicBlock *DefaultBB = BasicBlock::Create(CI.context, "match.default");
+  BasicBlock *MergeBB = BasicBlock::Create(CI.context, "match.end");
+  SwitchInst *Switch = 
+      CI.Builder.CreateSwitch(SubjectVal, DefaultBB, Cases.size());
+
+  std::vector<std::pair<Value *, BasicBlock *> > Incoming;
+  for(size_t idx = 0; idx < Cases.size(); idx++) {
+    BasicBlock *CaseBB = BasicBlock::Create(CI.context, "match.case", TheFunc);
+    Switch->addCase(CI.Builder.getInt32(Cases[idx].first), CaseBB);
+    CI.Builder.SetInsertPoint(CaseBB);
+    Value *CaseVal = Cases[idx].second->code_gen(CI);
+    check_cond(CaseVal != 0, "Error in code gen for case of match!\n");
+    CI.Builder.CreateBr(MergeBB);
+    Incoming.push_back(std::make_pair(CaseVal, CI.Builder.GetInsertBlock()));
+  }
+
+  TheFunc->getBasicBlockList().push_back(DefaultBB);
+  CI.Builder.SetInsertPoint(DefaultBB);
+  Value *DefaultVal = Default ? Default->code_gen(CI) : CI.Builder.getInt32(0);
+  check_cond(DefaultVal != 0, "Error in code gen for default of match!\n");
+  CI.Builder.CreateBr(MergeBB);
+  Incoming.push_back(std::make_pair(DefaultVal, CI.Builder.GetInsertBlock()));
+
+  TheFunc->getBasicBlockList().push_back(MergeBB);
+  CI.Builder.SetInsertPoint(MergeBB);
+  PHINode *Phi = CI.Builder.CreatePHI(Type::getInt32Ty(CI.context), 
+                                      Incoming.size(), "matchtmp");
+  for(size_t idx = 0; idx < Incoming.size(); idx++)
+    Phi->addIncoming(Incoming[idx].first, Incoming[idx].second);
+  return Phi;
+}
 
-Value *ExprForAST::code_gen() {
-  Value *StartVal = Start->code_gen();
+Value *ExprForAST::code_gen(CompilerInstance &CI) {
+  Value *StartVal = Start->code_gen(CI);
   check_cond(StartVal != 0, "Error, StartVal should not be null!\n");
+  CI.emitLocation(this);
 
-  Function *TheFunction = Builder.GetInsertBlock()->getParent();
-  BasicBlock *PreheaderBB = Builder.GetInsertBlock();
+  Function *TheFunction = CI.Builder.GetInsertBlock()->getParent();
+  BasicBlock *PreheaderBB = CI.Builder.GetInsertBlock();
 
-  BasicBlock *LoopBB =  BasicBlock::Create(context, "loop", TheFunction);
-  Builder.CreateBr(LoopBB);
-  Builder.SetInsertPoint(LoopBB);
-  PHINode *Variable = Builder.CreatePHI(Type::getInt32Ty(context), 
-                                        2, Var_Name.c_str());
+  BasicBlock *LoopBB =  BasicBlock::Create(CI.context, "loop", TheFunction);
+  CI.Builder.CreateBr(LoopBB);
+  CI.Builder.SetInsertPoint(LoopBB);
+  PHINode *Variable = CI.Builder.CreatePHI(Type::getInt32Ty(CI.context), 
+                                           2, Var_Name.c_str());
   Variable->addIncoming(StartVal, PreheaderBB);
-  Value *OldVal = Named_Values[Var_Name];
-  Named_Values[Var_Name] = Variable;
+  Value *OldVal = CI.Named_Values[Var_Name];
+  CI.Named_Values[Var_Name] = Variable;
 
-  check_cond(Body->code_gen() != 0, "Error in code gen for body in for!\n");
+  check_cond(Body->code_gen(CI) != 0, "Error in code gen for body in for!\n");
 
   Value *StepVal;
   if (Step) {
-    StepVal = Step->code_gen();
+    StepVal = Step->code_gen(CI);
     check_cond(StepVal != 0, "Error when code_gen of StepVal!\n");
   } else {
-    StepVal = ConstantInt::get(Type::getInt32Ty(context), 1);
+    StepVal = ConstantInt::get(Type::getInt32Ty(CI.context), 1);
   }
 
-  Value *NextVar = Builder.CreateAdd(Variable, StepVal, "nextvar");
+  CI.emitLocation(this);
+  Value *NextVar = CI.Builder.CreateAdd(Variable, StepVal, "nextvar");
 
-  Value *EndCond = End->code_gen();
+  Value *EndCond = End->code_gen(CI);
   if (EndCond == 0) {
     return EndCond;
   }
+  CI.emitLocation(this);
 
-  EndCond = Builder.CreateICmpNE(EndCond, 
-                                 ConstantInt::get(Type::getInt32Ty(context), 0),
-                                 "loopcond");
-  BasicBlock *LoopEndBB = Builder.GetInsertBlock();
-  BasicBlock *AfterBB = BasicBlock::Create(context, "afterloop", TheFunction);
-  Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
+  EndCond = CI.Builder.CreateICmpNE(
+      EndCond, ConstantInt::get(Type::getInt32Ty(CI.context), 0), "loopcond");
+  BasicBlock *LoopEndBB = CI.Builder.GetInsertBlock();
+  BasicBlock *AfterBB = 
+      BasicBlock::Create(CI.context, "afterloop", TheFunction);
+  CI.Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
 
-  Builder.SetInsertPoint(AfterBB);
+  CI.Builder.SetInsertPoint(AfterBB);
   Variable->addIncoming(NextVar, LoopEndBB);
 
   if (OldVal) {
-    Named_Values[Var_Name] = OldVal;
+    CI.Named_Values[Var_Name] = OldVal;
   } else {
-    Named_Values.erase(Var_Name);
+    CI.Named_Values.erase(Var_Name);
   }
 
-  return Constant::getNullValue(Type::getInt32Ty(context));
+  return Constant::getNullValue(Type::getInt32Ty(CI.context));
 }
 
+// i32 Name(i32 a, i32 b) for the combining operator.
+Function *ExprParallelForAST::combine_gen(CompilerInstance &CI,
+                                          const std::string &Name) {
+  Type *I32 = Type::getInt32Ty(CI.context);
+  Type *Params[2] = {I32, I32};
+  Function *F = Function::Create(FunctionType::get(I32, Params, false),
+                                 Function::InternalLinkage, Name,
+                                 CI.Module_ob);
+  Function::arg_iterator arg_it = F->arg_begin();
+  Value *A = &*arg_it++;
+  Value *B = &*arg_it;
+  CI.Builder.SetInsertPoint(BasicBlock::Create(CI.context, "entry", F));
+  CI.beginDebugFunction(F, getLine());
+  CI.emitLocation(this);
+
+  Value *Result;
+  if(Combiner == '+') {
+    Result = CI.Builder.CreateAdd(A, B, "addtmp");
+  } else if(Combiner == '*') {
+    Result = CI.Builder.CreateMul(A, B, "multmp");
+  } else {
+    Function *Op = CI.Module_ob->getFunction(std::string("binary") +
+                                             (char)Combiner);
+    check_cond(Op != 0, "Error: unknown binary operator!\n");
+    Value *Ops[2] = {A, B};
+    Result = CI.Builder.CreateCall(Op, Ops, "binop");
+  }
+  CI.Builder.CreateRet(Result);
+  return F;
+}
+
+// The body goes into a function of its own,
+//   i32 F.pfor(const i32 *env, i64 begin, i64 end)
+// computing the iterations [begin, end) and combining their values, which
+// toy_parallel_for() calls on its threads. The variables in scope are passed
+// in 'env', followed by start and step.
+Value *ExprParallelForAST::code_gen(CompilerInstance &CI) {
+  LLVMContext &C = CI.context;
+  IRBuilder<> &B = CI.Builder;
+  Type *I32 = Type::getInt32Ty(C);
+  Type *I64 = Type::getInt64Ty(C);
+
+  Value *StartVal = Start->code_gen(CI);
+  Value *EndVal = End->code_gen(CI);
+  Value *StepVal = Step ? Step->code_gen(CI) : B.getInt32(1);
+  check_cond(StartVal != 0 && EndVal != 0 && StepVal != 0,
+             "Error in code gen for the range of parallel for!\n");
+  CI.emitLocation(this);
+
+  // (end - start - 1) / step + 1 iterations, unsigned like '<'
+  Value *Empty = B.CreateOr(B.CreateICmpULE(EndVal, StartVal),
+                            B.CreateICmpEQ(StepVal, B.getInt32(0)));
+  Value *Div = B.CreateSelect(Empty, B.getInt32(1), StepVal);
+  Value *Count = B.CreateUDiv(
+      B.CreateSub(B.CreateSub(EndVal, StartVal), B.getInt32(1)), Div);
+  Count = B.CreateAdd(B.CreateZExt(Count, I64), B.getInt64(1));
+  Count = B.CreateSelect(Empty, B.getInt64(0), Count, "pfor.count");
+
+  std::vector<std::string> Captured;
+  std::vector<Value *> Captured_Values;
+  for(std::map<std::string, Value *>::iterator it = CI.Named_Values.begin();
+      it != CI.Named_Values.end(); ++it) {
+    if(it->second && it->first != Var_Name) {
+      Captured.push_back(it->first);
+      Captured_Values.push_back(it->second);
+    }
+  }
+  unsigned Slots = Captured.size() + 2;
+
+  BasicBlock *ParentBB = B.GetInsertBlock();
+  Function *Parent = ParentBB->getParent();
+  DIScope *Parent_Scope = CI.Debug_Scope;
+  Function *Combine = combine_gen(CI, Parent->getName().str() +
+                                      ".pfor.combine");
+
+  Type *Params[3] = {Type::getInt32PtrTy(C), I64, I64};
+  Function *Chunk = Function::Create(FunctionType::get(I32, Params, false),
+                                     Function::InternalLinkage,
+                                     Parent->getName() + ".pfor",
+                                     CI.Module_ob);
+  Function::arg_iterator arg_it = Chunk->arg_begin();
+  Value *Env = &*arg_it++;
+  Value *Begin = &*arg_it++;
+  Value *Last = &*arg_it;
+  Env->setName("env");
+  Begin->setName("begin");
+  Last->setName("end");
+
+  BasicBlock *EntryBB = BasicBlock::Create(C, "entry", Chunk);
+  B.SetInsertPoint(EntryBB);
+  CI.beginDebugFunction(Chunk, getLine());
+  std::map<std::string, Value *> Old_Values;
+  Old_Values.swap(CI.Named_Values);
+  for(unsigned idx = 0; idx < Captured.size(); idx++)
+    CI.Named_Values[Captured[idx]] =
+        B.CreateLoad(I32, B.CreateInBoundsGEP(I32, Env, B.getInt32(idx)),
+                     Captured[idx]);
+  Value *ChunkStart = B.CreateLoad(
+      I32, B.CreateInBoundsGEP(I32, Env, B.getInt32(Slots - 2)), "start");
+  Value *ChunkStep = B.CreateLoad(
+      I32, B.CreateInBoundsGEP(I32, Env, B.getInt32(Slots - 1)), "step");
+
+  BasicBlock *LoopBB = BasicBlock::Create(C, "loop", Chunk);
+  B.CreateBr(LoopBB);
+  B.SetInsertPoint(LoopBB);
+  PHINode *Index = B.CreatePHI(I64, 2, "k");
+  PHINode *Acc = B.CreatePHI(I32, 2, "acc");
+  Index->addIncoming(Begin, EntryBB);
+  Acc->addIncoming(UndefValue::get(I32), EntryBB);
+  CI.Named_Values[Var_Name] = B.CreateAdd(
+      ChunkStart, B.CreateMul(B.CreateTrunc(Index, I32), ChunkStep),
+      Var_Name);
+
+  Value *BodyVal = Body->code_gen(CI);
+  check_cond(BodyVal != 0, "Error in code gen for body in parallel for!\n");
+  CI.Named_Values.swap(Old_Values);
+
+  // the first iteration has nothing to combine with
+  BasicBlock *BodyEndBB = B.GetInsertBlock();
+  BasicBlock *CombineBB = BasicBlock::Create(C, "combine", Chunk);
+  BasicBlock *LatchBB = BasicBlock::Create(C, "latch", Chunk);
+  B.CreateCondBr(B.CreateICmpEQ(Index, Begin), LatchBB, CombineBB);
+  B.SetInsertPoint(CombineBB);
+  CI.emitLocation(this);
+  Value *Ops[2] = {Acc, BodyVal};
+  Value *Combined = B.CreateCall(Combine, Ops);
+  B.CreateBr(LatchBB);
+
+  B.SetInsertPoint(LatchBB);
+  PHINode *NextAcc = B.CreatePHI(I32, 2, "acc.next");
+  NextAcc->addIncoming(BodyVal, BodyEndBB);
+  NextAcc->addIncoming(Combined, CombineBB);
+  Value *NextIndex = B.CreateAdd(Index, B.getInt64(1), "k.next");
+  Index->addIncoming(NextIndex, LatchBB);
+  Acc->addIncoming(NextAcc, LatchBB);
+  BasicBlock *ExitBB = BasicBlock::Create(C, "exit", Chunk);
+  B.CreateCondBr(B.CreateICmpSLT(NextIndex, Last), LoopBB, ExitBB);
+  B.SetInsertPoint(ExitBB);
+  B.CreateRet(NextAcc);
+  verifyFunction(*Chunk);
+
+  // the environment lives in the entry block, so loops around this one do
+  // not grow the stack
+  IRBuilder<> EntryB(&Parent->getEntryBlock(),
+                     Parent->getEntryBlock().begin());
+  Value *EnvVal = EntryB.CreateAlloca(I32, EntryB.getInt32(Slots),
+                                      "pfor.env");
+  B.SetInsertPoint(ParentBB);
+  CI.Debug_Scope = Parent_Scope;
+  CI.emitLocation(this);
+  for(unsigned idx = 0; idx < Captured.size(); idx++)
+    B.CreateStore(Captured_Values[idx],
+                  B.CreateInBoundsGEP(I32, EnvVal, B.getInt32(idx)));
+  B.CreateStore(StartVal,
+                B.CreateInBoundsGEP(I32, EnvVal, B.getInt32(Slots - 2)));
+  B.CreateStore(StepVal,
+                B.CreateInBoundsGEP(I32, EnvVal, B.getInt32(Slots - 1)));
+
+  Function *Runtime = CI.Module_ob->getFunction("toy_parallel_for");
+  if(Runtime == 0) {
+    Type *RT_Params[4] = {Chunk->getType(), Type::getInt32PtrTy(C), I64,
+                          Combine->getType()};
+    Runtime = Function::Create(FunctionType::get(I32, RT_Params, false),
+                               Function::ExternalLinkage,
+                               "toy_parallel_for", CI.Module_ob);
+  }
+  Value *Args[4] = {Chunk, EnvVal, Count, Combine};
+  return B.CreateCall(Runtime, Args, "pfor");
+}
+
+
+Lexer::Lexer(FILE *input)
+    : Current_token(EOF_TOKEN), Numeric_Val(0), LastChar(' '), Line(1), 
+      Col(0), Token_Line(0), Token_Col(0), file(input), Buf(0), Len(0), 
+      Pos(0) {}
 
-static int get_token() {
+Lexer::Lexer(const char *buf, size_t len)
+    : Current_token(EOF_TOKEN), Numeric_Val(0), LastChar(' '), Line(1), 
+      Col(0), Token_Line(0), Token_Col(0), file(0), Buf(buf), Len(len), 
+      Pos(0) {}
+
+// LastChar is still the previous character here
+int Lexer::next_char() {
+  if(LastChar == '\n') {
+    Line++;
+    Col = 0;
+  }
+  Col++;
+  if(file)
+    return fgetc(file);
+  return Pos < Len ? (unsigned char)Buf[Pos++] : EOF;
+}
+
+int Lexer::get_token() {
   while(isspace(LastChar))
-    LastChar = fgetc(file);
+    LastChar = next_char();
+  Token_Line = Line;
+  Token_Col = Col;
 
   if(isalpha(LastChar)) {
     Identifier_string = LastChar;
 
-    while(isalnum((LastChar = fgetc(file))))
+    while(isalnum((LastChar = next_char())))
       Identifier_string += LastChar;
 
     if(Identifier_string == "def") {
@@ -489,6 +677,12 @@ static int get_token() {
       return FOR_TOKEN;
     } else if(Identifier_string == "in") {
       return IN_TOKEN;
+    } else if(Identifier_string == "parallel") {
+      return PARALLEL_TOKEN;
+    } else if(Identifier_string == "match") {
+      return MATCH_TOKEN;
+    } else if(Identifier_string == "with") {
+      return WITH_TOKEN;
     } else if(Identifier_string == "binary") {
       return BINARY_TOKEN;
     } else {
@@ -500,35 +694,35 @@ static int get_token() {
     std::string NumStr;
     do {
       NumStr += LastChar;
-      LastChar = fgetc(file);
+      LastChar = next_char();
     } while(isdigit(LastChar));
 
-    Numeric_Val = strtod(NumStr.c_str(), 0);
+    Numeric_Val = (int)strtoul(NumStr.c_str(), 0, 10);
     return NUMERIC_TOKEN;
   }
 
   if(LastChar == '#') {
     do {
-      LastChar = fgetc(file);
+      LastChar = next_char();
     } while(LastChar != EOF && LastChar != '\n' && LastChar != '\r');
    
-    LastChar = fgetc(file);
+    LastChar = next_char();
     // The next char of EOF is still EOF
     return COMMENT_TOKEN;
   }
 
   if(LastChar == '(') {
-    LastChar = fgetc(file);
+    LastChar = next_char();
     return LPARAN_TOKEN;
   }
 
   if(LastChar == ')') {
-    LastChar = fgetc(file);
+    LastChar = next_char();
     return RPARAN_TOKEN;
   }
 
   if(LastChar == ',') {
-    LastChar = fgetc(file);
+    LastChar = next_char();
     return COMM_TOKEN;
   }
 
@@ -536,212 +730,251 @@ static int get_token() {
     return EOF_TOKEN;
 
   int ThisChar = LastChar;
-  LastChar = fgetc(file);
+  LastChar = next_char();
   return ThisChar;
 }
 
-static void dump_token() {
-  std::map<int, std::string>::iterator it;
+static void dump_token(Lexer *Lex) {
+  std::map<int, std::string>::const_iterator it;
 
-  it = dump_str.find(Current_token);
+  it = dump_str.find(Lex->Current_token);
   if (it != dump_str.end()) {
     printf("%s", it->second.c_str());
   } else {
-    printf("Undefined token: %c", Current_token);
+    printf("Undefined token: %c", Lex->Current_token);
   }
-  printf(", LastChar: '%c'\n", LastChar);
+  printf(", LastChar: '%c'\n", Lex->LastChar);
   return;
 }
 
-static int next_token() {
+int Lexer::next_token() {
   do {
     Current_token = get_token();
   } while (Current_token == COMMENT_TOKEN);
-  // dump_token();
+  // dump_token(this);
   return Current_token;
 }
 
-static BaseAST *numeric_parser()
+int CompilerInstance::next_token() {
+  return Lex->next_token();
+}
+
+BaseAST *CompilerInstance::numeric_parser()
 {
-  BaseAST *Result = new NumericAST(Numeric_Val);
+  BaseAST *Result = intern_numeric(Lex->Numeric_Val);
   next_token();
   return Result;
 }
 
-static BaseAST *identifier_parser()
+BaseAST *CompilerInstance::identifier_parser()
 {
-  std::string IdName = Identifier_string;
+  std::string IdName = Lex->Identifier_string;
   next_token();
 
-  if(Current_token != LPARAN_TOKEN)
-    return new VariableAST(IdName);
+  if(Lex->Current_token != LPARAN_TOKEN)
+    return intern_variable(IdName);
 
   next_token();
   std::vector<BaseAST *> Args;
-  if(Current_token != RPARAN_TOKEN) {
+  bool Outer_Arm = In_Match_Arm;
+  In_Match_Arm = false;
+  if(Lex->Current_token != RPARAN_TOKEN) {
     while(true) {
       BaseAST *Arg = expression_parser();
       check_cond(Arg != 0, "Error from expression_parser!\n");
 
       Args.push_back(Arg);
-      if(Current_token == RPARAN_TOKEN)
+      if(Lex->Current_token == RPARAN_TOKEN)
 	break;
 
-      check_cond(Current_token == COMM_TOKEN, "Error in identifier_parser!\n");
+      check_cond(Lex->Current_token == COMM_TOKEN, 
+                 "Error in identifier_parser!\n");
       next_token();
     }
   }
+  In_Match_Arm = Outer_Arm;
   // equal to RPARAN_TOKEN
   next_token();
   return new FunctionCallAST(IdName, Args);
 }
 
-static FunctionDeclAST *func_decl_parser() {
+// BinaryAST::code_gen() has these built in, they cannot be redefined.
+static bool is_builtin_op(int Op) {
+  return Op == '<' || Op == '=' || Op == '+' || Op == '-' || Op == '*' || 
+         Op == '/';
+}
+
+FunctionDeclAST *CompilerInstance::func_decl_parser() {
   std::string FnName;
   unsigned Kind = 0;
   unsigned BinaryPrecedence = 30;
 
-  switch (Current_token) {
+  switch (Lex->Current_token) {
     case IDENTIFIER_TOKEN:
-      FnName = Identifier_string;
+      FnName = Lex->Identifier_string;
       Kind = 0;
       break;
     case UNARY_TOKEN:
       next_token();
-      check_cond(isascii(Current_token) != 0, "Error token followed Unary!\n");
+      check_cond(isascii(Lex->Current_token) != 0, 
+                 "Error token followed Unary!\n");
 
       FnName = "unary";
-      FnName += (char)Current_token;
+      FnName += (char)Lex->Current_token;
       Kind = 1;
 
       break;
     case BINARY_TOKEN:
       next_token();
-      check_cond(isascii(Current_token) != 0, "Error token followed Unary!\n");
+      check_cond(isascii(Lex->Current_token) != 0, 
+                 "Error token followed Unary!\n");
 
+      check_cond(!is_builtin_op(Lex->Current_token), 
+                 std::string("Error: binary ") + (char)Lex->Current_token + 
+                 " is a builtin operator!\n");
       FnName = "binary";
-      FnName += (char)Current_token;
+      FnName += (char)Lex->Current_token;
       Kind = 2;
       next_token();
 
       // if precedence is given
-      if (Current_token == NUMERIC_TOKEN) {
-        if (Numeric_Val < 1 || Numeric_Val > 100) {
-          printf("Error: wrong precedence number!");
-          exit(0);
-        }
-        BinaryPrecedence = (unsigned)Numeric_Val;
+      if (Lex->Current_token == NUMERIC_TOKEN) {
+        check_cond(Lex->Numeric_Val >= 1 && Lex->Numeric_Val <= 100, 
+                   "Error: wrong precedence number!");
+        BinaryPrecedence = (unsigned)Lex->Numeric_Val;
       }
 
       break;
     default:
-      printf("Error occured in func_decl_parser!\n");
-      exit(0);
+      check_cond(false, "Error occured in func_decl_parser!\n");
   }
 
   next_token();
-  check_cond(Current_token == LPARAN_TOKEN, 
+  check_cond(Lex->Current_token == LPARAN_TOKEN, 
              "Error in func_decl_parser: no left paran!\n");
 
   std::vector<std::string> FunctionArgNames;
   next_token();
-  while(Current_token == IDENTIFIER_TOKEN || Current_token == COMM_TOKEN) {
-    if (Current_token == IDENTIFIER_TOKEN) {
-      FunctionArgNames.push_back(Identifier_string);
+  while(Lex->Current_token == IDENTIFIER_TOKEN || 
+        Lex->Current_token == COMM_TOKEN) {
+    if (Lex->Current_token == IDENTIFIER_TOKEN) {
+      FunctionArgNames.push_back(Lex->Identifier_string);
     }
     next_token();
   }
 
-  check_cond(Current_token == RPARAN_TOKEN, 
+  check_cond(Lex->Current_token == RPARAN_TOKEN, 
              "Error in func_decl_parser: no right paran!\n");
-  if (Kind && FunctionArgNames.size() != Kind) {
-    printf("Error: kind and function arg name size do not match!\n");
-    exit(0);
-  }
+  check_cond(!Kind || FunctionArgNames.size() == Kind, 
+             "Error: kind and function arg name size do not match!\n");
 
   next_token();
   return new FunctionDeclAST(FnName, FunctionArgNames, 
                              Kind != 0, BinaryPrecedence);
 }
 
-static FunctionDefnAST *func_defn_parser() {
+FunctionDefnAST *CompilerInstance::func_defn_parser() {
+  unsigned Line = Lex->Token_Line, Col = Lex->Token_Col;
   // skip the 'def' token
   next_token();
   FunctionDeclAST *Decl = func_decl_parser();
   check_cond(Decl != 0, "Error in func_defn_parser: from func_decl_parser!\n");
 
-  if(BaseAST *Body = expression_parser())
-    return new FunctionDefnAST(Decl, Body);
+  if(BaseAST *Body = expression_parser()) {
+    FunctionDefnAST *Defn = new FunctionDefnAST(Decl, Body);
+    Defn->setLoc(Line, Col);
+    return Defn;
+  }
 
-  printf("Error in func_defn_parser!\n");
-  exit(0);
+  check_cond(false, "Error in func_defn_parser!\n");
+  return 0;
 }
 
-static BaseAST *expression_parser() {
+BaseAST *CompilerInstance::expression_parser() {
   BaseAST *LHS = Base_Parser();
   check_cond(LHS != 0, "Error in expression_parser: from Base_Parser!\n");
 
-  if(Current_token == EOF_TOKEN || Current_token == '\r' || 
-     Current_token == '\n')
+  if(Lex->Current_token == EOF_TOKEN || Lex->Current_token == '\r' || 
+     Lex->Current_token == '\n')
     return LHS;
   else
     return binary_op_parser(0, LHS);
 }
 
-static BaseAST *paran_parser() {
+BaseAST *CompilerInstance::paran_parser() {
   next_token();
+  bool Outer_Arm = In_Match_Arm;
+  In_Match_Arm = false;
   BaseAST *V = expression_parser();
   check_cond(V != 0, "Error in paran_parser: from expression_parser!\n");
+  In_Match_Arm = Outer_Arm;
 
-  if(Current_token != RPARAN_TOKEN)
+  if(Lex->Current_token != RPARAN_TOKEN)
     return 0;
+  // eat the ')'
+  next_token();
   return V;
 }
 
-static BaseAST *if_parser() {
+BaseAST *CompilerInstance::if_parser() {
   next_token();
 
   BaseAST *cond = expression_parser();
   check_cond(cond != 0, "Error in if_parser : empty cond!\n");
 
-  check_cond(Current_token == THEN_TOKEN, 
+  check_cond(Lex->Current_token == THEN_TOKEN, 
              "Error in if_parser: THEN_TOKEN is not followed!\n");
 
   next_token();
   BaseAST *Then = expression_parser();
   check_cond(Then != 0, "Error in if_parser : empty Then!\n");
-  check_cond(Current_token == ELSE_TOKEN, 
+  check_cond(Lex->Current_token == ELSE_TOKEN, 
              "Error in if_parser: ELSE_TOKEN is not followed!\n");
 
   next_token();
   BaseAST *Else = expression_parser();
   check_cond(Else != 0, "Error in if_parser : empty Else!\n");
 
+  // if x = N then a else b is a match of x with a single arm, which the
+  // match of an else-if on the same x takes over
+  BaseAST *Subject;
+  int Val;
+  if(SwitchConversion && cond->isEquality(Subject, Val) && 
+     Subject->isPure()) {
+    ExprMatchAST *Match = Else->asMatch();
+    if(Match == 0 || Match->getSubject() != Subject)
+      Match = new ExprMatchAST(Subject->retain(), Else);
+    Match->prependCase(Val, Then);
+    BaseAST::release(cond);
+    return Match;
+  }
+
   return new ExprIfAST(cond, Then, Else);
 }
 
-static BaseAST *for_parser() {
+BaseAST *CompilerInstance::for_parser() {
   next_token();
 
-  check_cond(Current_token == IDENTIFIER_TOKEN, 
+  check_cond(Lex->Current_token == IDENTIFIER_TOKEN, 
              "Error in for_parser, IDENTIFIER_TOKEN expected!\n");
-  std::string IdName = Identifier_string;
+  std::string IdName = Lex->Identifier_string;
 
   next_token();
-  check_cond(Current_token == '=', "Error in for_parser, '=' expected!\n");
+  check_cond(Lex->Current_token == '=', 
+             "Error in for_parser, '=' expected!\n");
 
   next_token();
   BaseAST *Start = expression_parser();
   check_cond(Start != 0, 
              "Error in for_parser (Start), from expression_parser!\n");
 
-  check_cond(Current_token == COMM_TOKEN, 
+  check_cond(Lex->Current_token == COMM_TOKEN, 
              "Error in for_parser, COMM_TOKEN expected!\n");
 
   next_token();
   BaseAST *End = expression_parser();
   check_cond(End != 0, "Error in for_parser (End), from expression_parser!\n");
-  check_cond(Current_token == COMM_TOKEN, 
+  check_cond(Lex->Current_token == COMM_TOKEN, 
              "Error in for_parser, COMM_TOKEN expected!\n");
 
   next_token();
@@ -749,7 +982,7 @@ static BaseAST *for_parser() {
   check_cond(Step != 0, 
              "Error in for_parser (Step), from expression_parser!\n");
 
-  check_cond(Current_token == IN_TOKEN, 
+  check_cond(Lex->Current_token == IN_TOKEN, 
              "Error in for_parser, IN_TOKEN expected!\n");
 
   next_token();
@@ -760,52 +993,229 @@ static BaseAST *for_parser() {
   return new ExprForAST (IdName, Start, End, Step, Body);
 }
 
-static BaseAST *Base_Parser() {
-  switch(Current_token) {
+// parallel [op] for i = start, end [, step] in body
+BaseAST *CompilerInstance::parallel_parser() {
+  next_token();
+
+  int Combiner = '+';
+  if(Lex->Current_token != FOR_TOKEN) {
+    Combiner = Lex->Current_token;
+    check_cond(getBinOpPrecedence() > 0 && Combiner != '<' &&
+               Combiner != '=' && Combiner != '-' && Combiner != '/',
+               "Error in parallel_parser, 'for' or a combining operator "
+               "expected!\n");
+    next_token();
+  }
+  check_cond(Lex->Current_token == FOR_TOKEN,
+             "Error in parallel_parser, FOR_TOKEN expected!\n");
+
+  next_token();
+  check_cond(Lex->Current_token == IDENTIFIER_TOKEN,
+             "Error in parallel_parser, IDENTIFIER_TOKEN expected!\n");
+  std::string IdName = Lex->Identifier_string;
+
+  next_token();
+  check_cond(Lex->Current_token == '=',
+             "Error in parallel_parser, '=' expected!\n");
+
+  next_token();
+  BaseAST *Start = expression_parser();
+  check_cond(Start != 0,
+             "Error in parallel_parser (Start), from expression_parser!\n");
+  check_cond(Lex->Current_token == COMM_TOKEN,
+             "Error in parallel_parser, COMM_TOKEN expected!\n");
+
+  next_token();
+  BaseAST *End = expression_parser();
+  check_cond(End != 0,
+             "Error in parallel_parser (End), from expression_parser!\n");
+
+  BaseAST *Step = 0;
+  if(Lex->Current_token == COMM_TOKEN) {
+    next_token();
+    Step = expression_parser();
+    check_cond(Step != 0,
+               "Error in parallel_parser (Step), from expression_parser!\n");
+  }
+
+  check_cond(Lex->Current_token == IN_TOKEN,
+             "Error in parallel_parser, IN_TOKEN expected!\n");
+
+  next_token();
+  BaseAST *Body = expression_parser();
+  check_cond(Body != 0,
+             "Error in parallel_parser (Body), from expression_parser!\n");
+
+  return new ExprParallelForAST(IdName, Start, End, Step, Body, Combiner);
+}
+
+// match subject with N -> expr | N -> expr ... [| _ -> expr]
+//
+// An arm ends at a '|', so a match inside an arm takes the arms after it
+// unless it is in parentheses.
+BaseAST *CompilerInstance::match_parser() {
+  next_token();
+  BaseAST *Subject = expression_parser();
+  check_cond(Subject != 0, 
+             "Error in match_parser (Subject), from expression_parser!\n");
+  check_cond(Lex->Current_token == WITH_TOKEN, 
+             "Error in match_parser, WITH_TOKEN expected!\n");
+
+  ExprMatchAST *Match = new ExprMatchAST(Subject, 0);
+  bool Outer_Arm = In_Match_Arm;
+  while(true) {
+    next_token();
+    bool Is_Default = Lex->Current_token == '_';
+    int Val = Lex->Numeric_Val;
+    check_cond(Is_Default || Lex->Current_token == NUMERIC_TOKEN, 
+               "Error in match_parser, NUMERIC_TOKEN or '_' expected!\n");
+    check_cond(Is_Default || !Match->hasCase(Val), 
+               "Error in match_parser, duplicate case " + 
+               std::to_string(Val) + "!\n");
+
+    next_token();
+    check_cond(Lex->Current_token == '-', 
+               "Error in match_parser, '->' expected!\n");
+    next_token();
+    check_cond(Lex->Current_token == '>', 
+               "Error in match_parser, '->' expected!\n");
+
+    next_token();
+    In_Match_Arm = true;
+    BaseAST *Body = expression_parser();
+    In_Match_Arm = Outer_Arm;
+    check_cond(Body != 0, 
+               "Error in match_parser (Body), from expression_parser!\n");
+
+    if(Is_Default) {
+      Match->setDefault(Body);
+      return Match;
+    }
+    Match->addCase(Val, Body);
+    if(Lex->Current_token != '|')
+      return Match;
+  }
+}
+
+BaseAST *CompilerInstance::Base_Parser() {
+  unsigned Line = Lex->Token_Line, Col = Lex->Token_Col;
+  BaseAST *Result = 0;
+  switch(Lex->Current_token) {
     case IDENTIFIER_TOKEN:
-      return identifier_parser();
+      Result = identifier_parser();
+      break;
     case NUMERIC_TOKEN:
-      return numeric_parser();
+      Result = numeric_parser();
+      break;
     case LPARAN_TOKEN:
-      return paran_parser();
+      Result = paran_parser();
+      break;
     case IF_TOKEN:
-      return if_parser();
+      Result = if_parser();
+      break;
     case FOR_TOKEN:
-      return for_parser(); 
+      Result = for_parser(); 
+      break;
+    case PARALLEL_TOKEN:
+      Result = parallel_parser();
+      break;
+    case MATCH_TOKEN:
+      Result = match_parser();
+      break;
     default:
-      return 0;
+      break;
   }
+  if(Result)
+    Result->setLoc(Line, Col);
+  return Result;
+}
+
+BaseAST *CompilerInstance::intern_numeric(int Val) {
+  BaseAST *&Node = Numeric_Nodes[Val];
+  if(Node == 0)
+    Node = new NumericAST(Val);
+  return Node->retain();
 }
 
-static void init_precedence() {
+BaseAST *CompilerInstance::intern_variable(const std::string &Name) {
+  BaseAST *&Node = Variable_Nodes[Name];
+  if(Node == 0) {
+    std::string name = Name;
+    Node = new VariableAST(name);
+  }
+  return Node->retain();
+}
+
+// Takes over the references to LHS and RHS. Equal pure children are the
+// same node already, so comparing them by address is enough.
+BaseAST *CompilerInstance::intern_binary(int Op, BaseAST *LHS, BaseAST *RHS) {
+  BaseAST *Node = new BinaryAST(std::to_string(Op), LHS, RHS);
+  if(!Node->isPure())
+    return Node;
+
+  BaseAST *&Shared = Binary_Nodes[std::make_tuple(Op, LHS, RHS)];
+  if(Shared == 0) {
+    Shared = Node->retain();
+    return Node;
+  }
+  BaseAST::release(Node);
+  return Shared->retain();
+}
+
+void CompilerInstance::clear_interned() {
+  std::map<int, BaseAST *>::iterator num_it;
+  for(num_it = Numeric_Nodes.begin(); num_it != Numeric_Nodes.end(); ++num_it)
+    BaseAST::release(num_it->second);
+  std::map<std::string, BaseAST *>::iterator var_it;
+  for(var_it = Variable_Nodes.begin(); var_it != Variable_Nodes.end(); 
+      ++var_it)
+    BaseAST::release(var_it->second);
+  std::map<std::tuple<int, BaseAST *, BaseAST *>, BaseAST *>::iterator bin_it;
+  for(bin_it = Binary_Nodes.begin(); bin_it != Binary_Nodes.end(); ++bin_it)
+    BaseAST::release(bin_it->second);
+
+  Numeric_Nodes.clear();
+  Variable_Nodes.clear();
+  Binary_Nodes.clear();
+}
+
+void CompilerInstance::init_precedence() {
   OperatorPrece['<'] = 1;
+  OperatorPrece['='] = 1;
   OperatorPrece['-'] = 2;
   OperatorPrece['+'] = 2;
   OperatorPrece['/'] = 3;
   OperatorPrece['*'] = 3;
 }
 
-static int getBinOpPrecedence() {
-  if(Current_token != '+' && Current_token != '-' && 
-     Current_token != '*' && Current_token != '/' &&
-     Current_token != '<') {
+// The builtin operators and the ones defined so far. The token values up
+// to BINARY_TOKEN are not characters and so never operators.
+int CompilerInstance::getBinOpPrecedence() {
+  if(Lex->Current_token <= BINARY_TOKEN || !isascii(Lex->Current_token))
+    return -1;
+  if(In_Match_Arm && Lex->Current_token == '|')
     return -1;
-  }
 
-  int TokPrec = OperatorPrece[Current_token];
+  std::map<char, int>::const_iterator it = 
+      OperatorPrece.find(Lex->Current_token);
+  if(it == OperatorPrece.end())
+    return -1;
+
+  int TokPrec = it->second;
   check_cond(TokPrec > 0, "Error in getBinOpPrecedence: Token_Type!\n");
 
   return TokPrec;
 }
 
-static BaseAST *binary_op_parser(int old_prec, BaseAST *LHS) {
+BaseAST *CompilerInstance::binary_op_parser(int old_prec, BaseAST *LHS) {
   while(1) {
     int cur_prec = getBinOpPrecedence();
 
     if(cur_prec < old_prec)
       return LHS;
     
-    int BinOp = Current_token;
+    int BinOp = Lex->Current_token;
+    unsigned Line = Lex->Token_Line, Col = Lex->Token_Col;
     next_token();
 
     BaseAST *RHS = Base_Parser();
@@ -817,41 +1227,44 @@ static BaseAST *binary_op_parser(int old_prec, BaseAST *LHS) {
       check_cond(RHS != 0, 
                  "Error in binary_op_parser: from binary_op_parser!\n");
     }
-    LHS = new BinaryAST(std::to_string(BinOp), LHS, RHS);
+    LHS = intern_binary(BinOp, LHS, RHS);
+    LHS->setLoc(Line, Col);
   }
 }
 
-static void HandleDefn() {
-  if(FunctionDefnAST *F = func_defn_parser()) {
-    if(Function *LF = (Function *)(F->code_gen())) {
-      ;
-    }
-    delete F;
-  }
-  else {
-    printf("Error in HandleDefn!\n");
-    exit(0);
-  }
+void CompilerInstance::HandleDefn() {
+  FunctionDefnAST *F = func_defn_parser();
+  check_cond(F != 0, "Error in HandleDefn!\n");
+  Parsed.push_back(F);
+  // nodes are only shared within an item
+  clear_interned();
+
+  // the items after the definition can use the operator
+  FunctionDeclAST *Decl = F->getDecl();
+  if(Decl->isBinaryOp())
+    OperatorPrece[Decl->getOperatorName()] = Decl->getBinaryPrecedence();
   return;
 }
 
-static void HandleTopExpression() {
-  if(BaseAST *E = expression_parser()) {
-    if(E->code_gen()) {
-      ;
-    }
-    delete E;
-  }
-  else {
-    printf("Error in HandleTopExpression\n");
-    exit(0);
-  }
+// A top-level expression becomes the body of a function of its own, so its
+// code does not end up behind the terminator of the previous function and
+// it can be called to get its value.
+void CompilerInstance::HandleTopExpression() {
+  BaseAST *E = expression_parser();
+  check_cond(E != 0, "Error in HandleTopExpression\n");
+
+  FunctionDeclAST *Decl = 
+      new FunctionDeclAST("__anon_expr" + std::to_string(Anon_Count++), 
+                          std::vector<std::string>());
+  Parsed.push_back(new FunctionDefnAST(Decl, E));
+  Parsed.back()->setLoc(E->getLine(), E->getCol());
+  clear_interned();
   return;
 }
 
-static void Driver() {
+void CompilerInstance::Driver() {
   while(true) {
-    switch(Current_token) {
+    switch(Lex->Current_token) {
       case EOF_TOKEN:
         return;
       case DEF_TOKEN:
@@ -864,7 +1277,9 @@ static void Driver() {
   }
 }
 
-void assign_dump_str() {
+static std::map<int, std::string> assign_dump_str() {
+  std::map<int, std::string> dump_str;
+
   // dump information
   dump_str[EOF_TOKEN] = "EOF_TOKEN"; 
   dump_str[NUMERIC_TOKEN] = "NUMERIC_TOKEN"; 
@@ -879,28 +1294,704 @@ void assign_dump_str() {
   dump_str[ELSE_TOKEN] = "ELSE_TOKEN"; 
   dump_str[FOR_TOKEN] = "FOR_TOKEN";
   dump_str[IN_TOKEN] = "IN_TOKEN";
+  dump_str[PARALLEL_TOKEN] = "PARALLEL_TOKEN";
+  dump_str[MATCH_TOKEN] = "MATCH_TOKEN";
+  dump_str[WITH_TOKEN] = "WITH_TOKEN";
   dump_str[BINARY_TOKEN] = "BINARY_TOKEN"; 
 
-  return;
+  return dump_str;
+}
+
+CompilerInstance::CompilerInstance()
+    : Module_ob(0), Builder(context), TheEngine(0), IfConversion(false), 
+      SwitchConversion(true), LazyCodegen(false), Skipped_Defns(0), 
+      DebugInfo(false), CollectRemarks(false), Debug_Scope(0), Lex(0), 
+      Anon_Count(0), In_Match_Arm(false), DBuilder(0), Debug_Unit(0) {}
+
+CompilerInstance::~CompilerInstance() {
+  clear_interned();
+  release_module();
+}
+
+void CompilerInstance::release_module() {
+  // the engine owns the module it was created for
+  if(TheEngine)
+    delete TheEngine;
+  else
+    delete Module_ob;
+  TheEngine = 0;
+  Module_ob = 0;
+}
+
+void delete_defns(std::vector<FunctionDefnAST *> &Defns) {
+  for(size_t idx = 0; idx < Defns.size(); idx++)
+    delete Defns[idx];
+  Defns.clear();
+}
+
+std::vector<FunctionDefnAST *> CompilerInstance::parse(Lexer &lex) {
+  OperatorPrece.clear();
+  init_precedence();
+  Anon_Count = 0;
+  return parse_items(lex);
 }
 
-int main(int argc, char **argv) {
+void CompilerInstance::startParse(Lexer &lex) {
+  OperatorPrece.clear();
   init_precedence();
-  assign_dump_str();
+  Anon_Count = 0;
+  In_Match_Arm = false;
+  clear_interned();
+
+  Lex = &lex;
+  next_token();
+}
+
+FunctionDefnAST *CompilerInstance::parseNext() {
+  check_cond(Lex != 0, "Error: parseNext() without startParse()!\n");
+  if(Lex->Current_token == EOF_TOKEN) {
+    Lex = 0;
+    return 0;
+  }
+
+  if(Lex->Current_token == DEF_TOKEN)
+    HandleDefn();
+  else
+    HandleTopExpression();
+  FunctionDefnAST *Result = Parsed.back();
+  Parsed.pop_back();
+  return Result;
+}
+
+// Parses with the operator table as it is.
+std::vector<FunctionDefnAST *> CompilerInstance::parse_items(Lexer &lex) {
+  Lex = &lex;
+  try {
+    next_token();
+    Driver();
+  } catch(...) {
+    delete_defns(Parsed);
+    clear_interned();
+    Lex = 0;
+    In_Match_Arm = false;
+    throw;
+  }
+  Lex = 0;
+
+  std::vector<FunctionDefnAST *> Result;
+  Result.swap(Parsed);
+  return Result;
+}
+
+// Offsets of the 'def' tokens in the buffer. Uses the character classes of
+// Lexer::get_token() without building the tokens, so comments and names
+// such as 'undef' are skipped just like the lexer does. The 'def' in
+// 'def binary def' is the operator and not the start of an item.
+static std::vector<size_t> find_defs(const char *buf, size_t len) {
+  std::vector<size_t> Defs;
+  int after_def = 0;
+  size_t pos = 0;
+  while(pos < len) {
+    int c = (unsigned char)buf[pos];
+    if(isspace(c)) {
+      pos++;
+      continue;
+    }
+
+    size_t start = pos;
+    if(isalpha(c)) {
+      while(pos < len && isalnum((unsigned char)buf[pos]))
+        pos++;
+    } else if(isdigit(c)) {
+      while(pos < len && isdigit((unsigned char)buf[pos]))
+        pos++;
+    } else if(c == '#') {
+      while(pos < len && buf[pos] != '\n' && buf[pos] != '\r')
+        pos++;
+      continue;
+    } else {
+      pos++;
+    }
+
+    bool is_def = pos - start == 3 && memcmp(buf + start, "def", 3) == 0;
+    if(is_def && after_def != 2) {
+      Defs.push_back(start);
+      after_def = 1;
+    } else if(after_def == 1 && pos - start == 6 && 
+              memcmp(buf + start, "binary", 6) == 0) {
+      after_def = 2;
+    } else {
+      after_def = 0;
+    }
+  }
+  return Defs;
+}
+
+// Adds the precedence of the operator if the item at 'buf' defines a binary
+// operator, the same way func_decl_parser() reads it.
+static void scan_operator(const char *buf, size_t len, 
+                          std::map<char, int> &OperatorPrece) {
+  Lexer lex(buf, len);
+  lex.next_token();
+  if(lex.next_token() != BINARY_TOKEN)
+    return;
+
+  int Op = lex.next_token();
+  if(!isascii(Op) || is_builtin_op(Op))
+    return;
+  int Prec = lex.next_token() == NUMERIC_TOKEN ? lex.Numeric_Val : 30;
+  OperatorPrece[Op] = Prec;
+}
+
+std::vector<FunctionDefnAST *> 
+CompilerInstance::parseBuffer(const char *buf, size_t len, unsigned Threads) {
+  // the lexer stops at a NUL byte
+  if(const char *nul = (const char *)memchr(buf, 0, len))
+    len = nul - buf;
+  if(Threads == 0)
+    Threads = len < Parallel_Parse_Size ? 1 : 
+              std::thread::hardware_concurrency();
+
+  std::vector<size_t> Cuts(1, 0);
+  std::vector<size_t> Defs;
+  if(Threads > 1)
+    Defs = find_defs(buf, len);
+  for(size_t idx = 0; idx < Defs.size(); idx++) {
+    if(Defs[idx] - Cuts.back() >= len / Threads)
+      Cuts.push_back(Defs[idx]);
+  }
+  if(Cuts.size() == 1) {
+    Lexer lex(buf, len);
+    return parse(lex);
+  }
+  Cuts.push_back(len);
+  size_t Chunks = Cuts.size() - 1;
+
+  // every piece starts with the operators defined before it
+  OperatorPrece.clear();
+  init_precedence();
+  std::vector<std::map<char, int> > Tables;
+  size_t next_def = 0;
+  for(size_t k = 0; k <= Chunks; k++) {
+    for(; next_def < Defs.size() && Defs[next_def] < Cuts[k]; next_def++)
+      scan_operator(buf + Defs[next_def], len - Defs[next_def], 
+                    OperatorPrece);
+    if(k < Chunks)
+      Tables.push_back(OperatorPrece);
+  }
+
+  // and at its line of the buffer
+  std::vector<unsigned> Lines(1, 1);
+  for(size_t k = 1; k < Chunks; k++)
+    Lines.push_back(Lines.back() + std::count(buf + Cuts[k - 1], 
+                                              buf + Cuts[k], '\n'));
+
+  std::vector<std::vector<FunctionDefnAST *> > Results(Chunks);
+  std::vector<std::exception_ptr> Errors(Chunks);
+  std::vector<std::thread> Workers;
+  for(size_t k = 0; k < Chunks; k++) {
+    Workers.push_back(std::thread([&, k]() {
+      try {
+        CompilerInstance Worker;
+        Worker.OperatorPrece = Tables[k];
+        Lexer lex(buf + Cuts[k], Cuts[k + 1] - Cuts[k]);
+        lex.Line = Lines[k];
+        Results[k] = Worker.parse_items(lex);
+      } catch(...) {
+        Errors[k] = std::current_exception();
+      }
+    }));
+  }
+  for(size_t k = 0; k < Chunks; k++)
+    Workers[k].join();
+
+  // the first error in source order is the one parse() would report
+  std::vector<FunctionDefnAST *> Result;
+  for(size_t k = 0; k < Chunks; k++)
+    Result.insert(Result.end(), Results[k].begin(), Results[k].end());
+  for(size_t k = 0; k < Chunks; k++) {
+    if(Errors[k]) {
+      delete_defns(Result);
+      std::rethrow_exception(Errors[k]);
+    }
+  }
 
-  TheEngine = EngineBuilder(Module_ob).create();
-  file = fopen(argv[1], "r");
-  if(file == NULL) {
-    printf("Error: unable to open %s.\n", argv[1]);
-    exit(0);
+  Anon_Count = 0;
+  for(size_t idx = 0; idx < Result.size(); idx++) {
+    FunctionDeclAST *Decl = Result[idx]->getDecl();
+    if(Decl->getName().compare(0, 11, "__anon_expr") == 0)
+      Decl->setName("__anon_expr" + std::to_string(Anon_Count++));
   }
+  return Result;
+}
+
+// Marks the definitions reachable from the top-level expressions and the
+// 'Roots' through calls and user operators.
+static std::vector<bool> 
+reachable_defns(const std::vector<FunctionDefnAST *> &Defns,
+                const std::vector<std::string> &Roots) {
+  std::map<std::string, std::vector<size_t> > By_Name;
+  std::vector<std::string> Work(Roots);
+  for(size_t idx = 0; idx < Defns.size(); idx++) {
+    const std::string &Name = Defns[idx]->getDecl()->getName();
+    By_Name[Name].push_back(idx);
+    if(Name.compare(0, 11, "__anon_expr") == 0)
+      Work.push_back(Name);
+  }
+
+  std::vector<bool> Needed(Defns.size(), false);
+  std::set<std::string> Seen;
+  while(!Work.empty()) {
+    std::string Name = Work.back();
+    Work.pop_back();
+    if(!Seen.insert(Name).second)
+      continue;
+
+    // a name defined twice keeps both, codegen reports the redefinition
+    std::vector<size_t> &Found = By_Name[Name];
+    for(size_t idx = 0; idx < Found.size(); idx++) {
+      Needed[Found[idx]] = true;
+      Defns[Found[idx]]->collectCallees(Work);
+    }
+  }
+  return Needed;
+}
+
+void CompilerInstance::beginDebugFunction(Function *F, unsigned Line) {
+  Builder.SetCurrentDebugLocation(DebugLoc());
+  if(DBuilder == 0)
+    return;
+
+  // the outlined functions of 'parallel for' only get a return type
+  DIType *Int = DBuilder->createBasicType("int", 32, dwarf::DW_ATE_signed);
+  std::vector<Metadata *> Types(1, Int);
+  bool Integers = true;
+  for(Function::arg_iterator arg_it = F->arg_begin(); arg_it != F->arg_end();
+      ++arg_it)
+    Integers = Integers && arg_it->getType()->isIntegerTy(32);
+  if(Integers)
+    Types.resize(F->arg_size() + 1, Int);
+  DISubroutineType *Ty = 
+      DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(Types));
+
+#if LLVM_VERSION_MAJOR >= 8
+  DISubprogram::DISPFlags Flags = DISubprogram::SPFlagDefinition;
+  if(F->hasLocalLinkage())
+    Flags |= DISubprogram::SPFlagLocalToUnit;
+  DISubprogram *SP = DBuilder->createFunction(
+      Debug_Unit, F->getName(), StringRef(), Debug_Unit->getFile(), Line, Ty,
+      Line, DINode::FlagPrototyped, Flags);
+#else
+  DISubprogram *SP = DBuilder->createFunction(
+      Debug_Unit, F->getName(), StringRef(), Debug_Unit->getFile(), Line, Ty,
+      F->hasLocalLinkage(), true, Line, DINode::FlagPrototyped);
+#endif
+  F->setSubprogram(SP);
+  Debug_Scope = SP;
+}
+
+void CompilerInstance::emitLocation(const BaseAST *Node) {
+  if(Debug_Scope == 0)
+    return;
+  Builder.SetCurrentDebugLocation(
+      DILocation::get(context, Node->getLine(), Node->getCol(), Debug_Scope));
+}
+
+Module *CompilerInstance::codegen(const std::vector<FunctionDefnAST *> &Defns) {
+  release_module();
+  Named_Values.clear();
+  Expr_Values.clear();
+  Builder.ClearInsertionPoint();
+  Builder.SetCurrentDebugLocation(DebugLoc());
 
   Module_ob = new Module("my compiler", context);
-  next_token();
-  Driver();
+  if(DebugInfo) {
+    Module_ob->addModuleFlag(Module::Warning, "Debug Info Version", 
+                             DEBUG_METADATA_VERSION);
+    DBuilder = new DIBuilder(*Module_ob);
+    Debug_Unit = DBuilder->createCompileUnit(
+        dwarf::DW_LANG_C, DBuilder->createFile(Source_Name, "."), "toy", 
+        false, "", 0);
+  }
+  std::vector<bool> Needed(Defns.size(), true);
+  if(LazyCodegen)
+    Needed = reachable_defns(Defns, Exported_Names);
+  Skipped_Defns = std::count(Needed.begin(), Needed.end(), false);
+  try {
+    for(size_t idx = 0; idx < Defns.size(); idx++) {
+      if(Needed[idx])
+        Defns[idx]->code_gen(*this);
+    }
+  } catch(...) {
+    delete DBuilder;
+    DBuilder = 0;
+    Debug_Scope = 0;
+    release_module();
+    throw;
+  }
+  if(DBuilder) {
+    DBuilder->finalize();
+    delete DBuilder;
+    DBuilder = 0;
+    Debug_Scope = 0;
+  }
+  return Module_ob;
+}
+
+Module *CompilerInstance::compile_defns(std::vector<FunctionDefnAST *> &Defns,
+                                       bool codegen) {
+  try {
+    if(codegen) {
+      this->codegen(Defns);
+    } else {
+      release_module();
+      Module_ob = new Module("my compiler", context);
+    }
+  } catch(...) {
+    delete_defns(Defns);
+    throw;
+  }
+  delete_defns(Defns);
+  return Module_ob;
+}
+
+Module *CompilerInstance::compile(Lexer &lex, bool codegen) {
+  std::vector<FunctionDefnAST *> Defns = parse(lex);
+  return compile_defns(Defns, codegen);
+}
+
+Module *CompilerInstance::compileBuffer(const char *buf, size_t len) {
+  std::vector<FunctionDefnAST *> Defns = parseBuffer(buf, len);
+  return compile_defns(Defns, true);
+}
+
+Module *CompilerInstance::compileFile(FILE *input) {
+  Lexer lex(input);
+  return compile(lex);
+}
+
+static bool init_native_target() {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+  // JITed code calls the runtime linked into this binary
+  sys::DynamicLibrary::AddSymbol("toy_parallel_for", 
+                                 (void *)&toy_parallel_for);
+  return true;
+}
+
+// generate code for the host CPU, so the vectorizer may use all of it
+static EngineBuilder &for_host(EngineBuilder &EB) {
+  static const bool Initialized = init_native_target();
+  (void)Initialized;
+
+  StringMap<bool> HostFeatures;
+  std::vector<std::string> MAttrs;
+  if(sys::getHostCPUFeatures(HostFeatures)) {
+    for(StringMap<bool>::iterator it = HostFeatures.begin(); 
+        it != HostFeatures.end(); ++it)
+      MAttrs.push_back((it->second ? "+" : "-") + it->first().str());
+  }
+  return EB.setMCPU(sys::getHostCPUName()).setMAttrs(MAttrs);
+}
+
+ExecutionEngine *CompilerInstance::createEngine() {
+  check_cond(Module_ob != 0 && TheEngine == 0, 
+             "Error: no module to create an engine for!\n");
+
+  std::string Err;
+  EngineBuilder EB((std::unique_ptr<Module>(Module_ob)));
+  TheEngine = for_host(EB).setEngineKind(EngineKind::JIT)
+                          .setErrorStr(&Err)
+                          .create();
+  if(TheEngine == 0) {
+    Module_ob = 0;
+    check_cond(false, "Error: unable to create the JIT: " + Err + "\n");
+  }
+  return TheEngine;
+}
+
+TargetMachine *CompilerInstance::createTargetMachine() {
+  std::string Err;
+  EngineBuilder EB;
+  TargetMachine *TM = for_host(EB).setErrorStr(&Err).selectTarget();
+  check_cond(TM != 0, "Error: no target for the host: " + Err + "\n");
+  return TM;
+}
+
+// Adds DI to the remarks if it is an optimization remark.
+static bool add_remark(const DiagnosticInfo &DI, 
+                       std::vector<Opt_Remark> &Remarks) {
+  const DiagnosticInfoOptimizationBase *OR = 
+      dyn_cast<DiagnosticInfoOptimizationBase>(&DI);
+  if(OR == 0)
+    return false;
+
+  Opt_Remark R;
+  R.Kind = OR->isPassed() ? "passed" : OR->isMissed() ? "missed" : "analysis";
+  R.Pass = std::string(OR->getPassName());
+  R.Name = OR->getRemarkName().str();
+  R.Function = OR->getFunction().getName().str();
+  R.Message = OR->getMsg();
+  R.Line = R.Col = 0;
+  if(OR->isLocationAvailable()) {
+    StringRef File;
+#if LLVM_VERSION_MAJOR >= 6
+    OR->getLocation(File, R.Line, R.Col);
+#else
+    OR->getLocation(&File, &R.Line, &R.Col);
+#endif
+    R.File = File.str();
+  }
+  Remarks.push_back(R);
+  return true;
+}
+
+#if LLVM_VERSION_MAJOR >= 6
+namespace {
+// Takes every remark, whatever the -pass-remarks options say, the other
+// diagnostics go their usual way.
+struct Remark_Handler : public DiagnosticHandler {
+  std::vector<Opt_Remark> &Remarks;
 
-  printf("================================\n");
-  Module_ob->print(outs(), nullptr);
-  fclose(file);
+  Remark_Handler(std::vector<Opt_Remark> &remarks) : Remarks(remarks) {}
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    return add_remark(DI, Remarks);
+  }
+  // not the instruction counts after every pass
+  bool isAnalysisRemarkEnabled(StringRef Pass) const override {
+    return Pass != "size-info";
+  }
+  bool isMissedOptRemarkEnabled(StringRef) const override { return true; }
+  bool isPassedOptRemarkEnabled(StringRef) const override { return true; }
+  bool isAnyRemarkEnabled() const override { return true; }
+};
+}
+#else
+static void handle_remark(const DiagnosticInfo &DI, void *Context) {
+  if(add_remark(DI, *(std::vector<Opt_Remark> *)Context))
+    return;
+  DiagnosticPrinterRawOStream DP(errs());
+  errs() << "toy: ";
+  DI.print(DP);
+  errs() << "\n";
 }
+#endif
+
+void CompilerInstance::optimize(unsigned OptLevel) {
+  check_cond(Module_ob != 0, "Error: no module to optimize!\n");
+
+#if LLVM_VERSION_MAJOR >= 6
+  std::unique_ptr<DiagnosticHandler> Old_Handler;
+  if(CollectRemarks) {
+    Old_Handler = context.getDiagnosticHandler();
+    context.setDiagnosticHandler(
+        std::unique_ptr<DiagnosticHandler>(new Remark_Handler(Remarks)));
+  }
+#else
+  LLVMContext::DiagnosticHandlerTy Old_Handler = 
+      context.getDiagnosticHandler();
+  void *Old_Context = context.getDiagnosticContext();
+  if(CollectRemarks)
+    context.setDiagnosticHandler(handle_remark, &Remarks);
+#endif
 
+  PassManagerBuilder PMB;
+  PMB.OptLevel = OptLevel;
+  if(OptLevel > 1) {
+    PMB.Inliner = createFunctionInliningPass(OptLevel, 0, false);
+    PMB.LoopVectorize = true;
+    PMB.SLPVectorize = true;
+  }
+
+  legacy::FunctionPassManager FPM(Module_ob);
+  legacy::PassManager MPM;
+  // with a JIT around, the cost models know the actual target
+  if(TheEngine && TheEngine->getTargetMachine()) {
+    TargetMachine *TM = TheEngine->getTargetMachine();
+    TM->adjustPassManager(PMB);
+    FPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    MPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+  }
+  PMB.populateFunctionPassManager(FPM);
+  PMB.populateModulePassManager(MPM);
+
+  FPM.doInitialization();
+  for(Function &F : *Module_ob)
+    FPM.run(F);
+  FPM.doFinalization();
+  MPM.run(*Module_ob);
+
+  if(CollectRemarks) {
+#if LLVM_VERSION_MAJOR >= 6
+    context.setDiagnosticHandler(std::move(Old_Handler));
+#else
+    context.setDiagnosticHandler(Old_Handler, Old_Context);
+#endif
+  }
+}
+
+// A callee and the constants of a call site, null for the other arguments.
+typedef std::pair<Function *, std::vector<Constant *> > Spec_Key;
+
+static std::string spec_name(const Spec_Key &Key) {
+  std::string Name = Key.first->getName().str();
+  for(size_t idx = 0; idx < Key.second.size(); idx++) {
+    if(ConstantInt *C = dyn_cast_or_null<ConstantInt>(Key.second[idx]))
+      Name += "." + std::to_string(C->getSExtValue());
+    else
+      Name += "._";
+  }
+  return Name;
+}
+
+// The value of a function that came down to returning a constant.
+static ConstantInt *constant_result(Function *F) {
+  if(F->size() != 1)
+    return 0;
+  ReturnInst *Ret = dyn_cast<ReturnInst>(&F->getEntryBlock().front());
+  return Ret ? dyn_cast_or_null<ConstantInt>(Ret->getReturnValue()) : 0;
+}
+
+unsigned CompilerInstance::specialize(unsigned Budget) {
+  check_cond(Module_ob != 0, "Error: no module to specialize!\n");
+
+  legacy::FunctionPassManager FPM(Module_ob);
+  FPM.add(createSCCPPass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.add(createCFGSimplificationPass());
+  FPM.add(createLoopRotatePass());
+  FPM.add(createIndVarSimplifyPass());
+  FPM.add(createLoopUnrollPass());
+  FPM.add(createInstructionCombiningPass());
+  FPM.add(createCFGSimplificationPass());
+  FPM.doInitialization();
+
+  std::map<Spec_Key, Function *> Clones;
+  std::map<Function *, Spec_Key> Is_Clone;
+  // Calls to clones that fold to a constant are replaced by it, which may
+  // fold their callers in turn: repeat until nothing folds any more.
+  bool Folded = true;
+  while(Folded) {
+    Folded = false;
+    std::vector<Function *> Work;
+    for(Function &F : *Module_ob) {
+      if(!F.isDeclaration())
+        Work.push_back(&F);
+    }
+
+    while(!Work.empty()) {
+      Function *Caller = Work.back();
+      Work.pop_back();
+
+      std::vector<CallInst *> Calls;
+      for(BasicBlock &BB : *Caller) {
+        for(Instruction &I : BB) {
+          if(CallInst *Call = dyn_cast<CallInst>(&I))
+            Calls.push_back(Call);
+        }
+      }
+
+      bool Changed = false;
+      bool Constants = false;
+      for(size_t call_idx = 0; call_idx < Calls.size(); call_idx++) {
+        CallInst *Call = Calls[call_idx];
+        Function *Callee = Call->getCalledFunction();
+        if(Callee == 0 || Callee->isDeclaration())
+          continue;
+
+        // a call to a clone whose arguments have folded to constants since
+        // is specialized again from the original callee
+        Spec_Key Key(Callee, std::vector<Constant *>(Callee->arg_size()));
+        std::map<Function *, Spec_Key>::iterator clone_it =
+            Is_Clone.find(Callee);
+        if(clone_it != Is_Clone.end()) {
+          if(ConstantInt *C = constant_result(Callee)) {
+            Call->replaceAllUsesWith(C);
+            Call->eraseFromParent();
+            Changed = Constants = true;
+            continue;
+          }
+          Key = clone_it->second;
+        }
+
+        std::vector<Value *> Args;
+        bool Any = false;
+        for(unsigned idx = 0, arg_idx = 0; idx < Key.second.size(); idx++) {
+          if(Key.second[idx])
+            continue;
+          Value *Arg = Call->getArgOperand(arg_idx++);
+          Key.second[idx] = dyn_cast<ConstantInt>(Arg);
+          if(Key.second[idx])
+            Any = true;
+          else
+            Args.push_back(Arg);
+        }
+        if(!Any)
+          continue;
+
+        Function *&Clone = Clones[Key];
+        if(Clone == 0) {
+          if(Clones.size() > Budget) {
+            Clones.erase(Key);
+            continue;
+          }
+          ValueToValueMapTy VMap;
+          Function::arg_iterator arg_it = Key.first->arg_begin();
+          for(unsigned idx = 0; idx < Key.second.size(); idx++, ++arg_it) {
+            if(Key.second[idx])
+              VMap[&*arg_it] = Key.second[idx];
+          }
+          Clone = CloneFunction(Key.first, VMap);
+          Clone->setLinkage(Function::InternalLinkage);
+          Clone->setName(spec_name(Key));
+          Is_Clone[Clone] = Key;
+          FPM.run(*Clone);
+          Work.push_back(Clone);
+        }
+
+        if(ConstantInt *C = constant_result(Clone)) {
+          Call->replaceAllUsesWith(C);
+          Constants = true;
+        } else {
+          Builder.SetInsertPoint(Call);
+          CallInst *New = Builder.CreateCall(Clone, Args);
+          New->takeName(Call);
+          Call->replaceAllUsesWith(New);
+        }
+        Call->eraseFromParent();
+        Changed = true;
+      }
+
+      // constants in place of calls may fold into the arguments of other
+      // calls, so the caller is simplified and scanned again
+      bool Clone_Caller = Is_Clone.count(Caller);
+      if(Clone_Caller ? Changed : Constants)
+        FPM.run(*Caller);
+      if(Constants)
+        Work.push_back(Caller);
+      if(Changed && Clone_Caller && constant_result(Caller))
+        Folded = true;
+    }
+  }
+  Builder.ClearInsertionPoint();
+  FPM.doFinalization();
+
+  // clones every call of which was folded away, which may leave the clones
+  // they call unused as well
+  size_t Erased = 1;
+  while(Erased) {
+    Erased = 0;
+    std::map<Function *, Spec_Key>::iterator it = Is_Clone.begin();
+    while(it != Is_Clone.end()) {
+      if(it->first->use_empty()) {
+        it->first->eraseFromParent();
+        Is_Clone.erase(it++);
+        Erased++;
+      } else {
+        ++it;
+      }
+    }
+  }
+  return Is_Clone.size();
+}
@@ -0,0 +1,227 @@
+#ifndef TOY_H
+#define TOY_H
+
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+
+namespace llvm {
+class DIBuilder;
+class DICompileUnit;
+class DIScope;
+class ExecutionEngine;
+class TargetMachine;
+}
+
+enum Token_Type {
+  EOF_TOKEN = 0,
+  NUMERIC_TOKEN,
+  IDENTIFIER_TOKEN,
+  LPARAN_TOKEN,
+  RPARAN_TOKEN,
+  DEF_TOKEN,
+  COMM_TOKEN,
+  COMMENT_TOKEN,
+  IF_TOKEN,
+  THEN_TOKEN,
+  ELSE_TOKEN,
+  FOR_TOKEN,
+  IN_TOKEN,
+  UNARY_TOKEN,
+  PARALLEL_TOKEN,
+  MATCH_TOKEN,
+  WITH_TOKEN,
+  BINARY_TOKEN
+};
+
+// Thrown for every lexing, parsing and code generation error.
+class CompileError : public std::runtime_error {
+public:
+  CompileError(const std::string &message) : std::runtime_error(message) {}
+};
+
+void check_cond(bool cond, std::string message);
+
+// All the lexer state, reading either from a FILE* or from a memory buffer
+// (which is not copied and must outlive the lexer).
+class Lexer {
+public:
+  Lexer(FILE *input);
+  Lexer(const char *buf, size_t len);
+
+  int get_token();
+  // Like get_token() but skips comments, the result is kept in Current_token.
+  int next_token();
+
+  int Current_token;
+  int Numeric_Val;
+  std::string Identifier_string;
+  int LastChar;
+  // Line and column of LastChar, counted from 1, and of the start of the
+  // last token. A lexer for a piece of a buffer can start at a later line.
+  unsigned Line, Col;
+  unsigned Token_Line, Token_Col;
+
+private:
+  int next_char();
+
+  FILE *file;
+  const char *Buf;
+  size_t Len, Pos;
+};
+
+class BaseAST;
+class FunctionDeclAST;
+class FunctionDefnAST;
+
+// An optimization remark of optimize(), with the toy source location of
+// the code it is about. Line is 0 where that is unknown.
+struct Opt_Remark {
+  std::string Kind; // "passed", "missed" or "analysis"
+  std::string Pass, Name, Function, Message;
+  std::string File;
+  unsigned Line, Col;
+};
+
+// Holds all the parser, symbol and code generation state of one compilation,
+// independent instances can be used from different threads at once.
+class CompilerInstance {
+public:
+  CompilerInstance();
+  ~CompilerInstance();
+
+  // Parses everything the lexer produces. Top-level expressions come back as
+  // functions __anon_expr0, __anon_expr1, ... of no arguments. The caller
+  // owns the returned ASTs, see delete_defns().
+  std::vector<FunctionDefnAST *> parse(Lexer &lex);
+  // Like parse() on a memory buffer, but the buffer is cut at top-level
+  // 'def's and the pieces are parsed on 'Threads' threads at once. With 0
+  // there is one thread per core for inputs of Parallel_Parse_Size bytes
+  // and more, smaller inputs are parsed right away.
+  std::vector<FunctionDefnAST *> parseBuffer(const char *buf, size_t len,
+                                             unsigned Threads = 0);
+  static const size_t Parallel_Parse_Size = 1 << 20;
+  // Parses one top-level item at a time, so the input need not be held in
+  // memory at once: startParse() and then parseNext() until it returns 0 at
+  // the end of the input. The caller owns the returned ASTs.
+  void startParse(Lexer &lex);
+  FunctionDefnAST *parseNext();
+  // Generates code for the functions into a new module, replacing the
+  // previous one. The module is owned by the instance and lives in its
+  // context.
+  llvm::Module *codegen(const std::vector<FunctionDefnAST *> &Defns);
+
+  // parse() followed by codegen(). With 'codegen' off the input is only
+  // parsed and the module stays empty.
+  llvm::Module *compile(Lexer &lex, bool codegen = true);
+  llvm::Module *compileBuffer(const char *buf, size_t len);
+  llvm::Module *compileFile(FILE *input);
+
+  // Runs the standard -O<OptLevel> pipeline over the module.
+  void optimize(unsigned OptLevel);
+  // Clones the functions called with constant arguments, one clone per
+  // callee and signature of constants, which all call sites with that
+  // signature share. The constants replace the parameters and the clone is
+  // simplified, so loops with constant bounds unroll or fold away; calls in
+  // the clones are specialized in turn. Makes at most 'Budget' clones and
+  // returns the number of them still called after folding.
+  unsigned specialize(unsigned Budget = Specialize_Budget);
+  static const unsigned Specialize_Budget = 64;
+  // Creates a JIT for the module in TheEngine. The engine takes the module
+  // over, but Module_ob stays usable until the first function address is
+  // looked up.
+  llvm::ExecutionEngine *createEngine();
+  // A target machine for the host CPU, owned by the caller.
+  llvm::TargetMachine *createTargetMachine();
+
+  llvm::LLVMContext context;
+  llvm::Module *Module_ob;
+  llvm::IRBuilder<> Builder;
+  std::map<std::string, llvm::Value*> Named_Values;
+  // values of the pure expressions already generated in a block
+  std::map<std::pair<llvm::BasicBlock*, BaseAST*>, llvm::Value*> Expr_Values;
+  llvm::ExecutionEngine *TheEngine;
+  std::map<char, int> OperatorPrece;
+  // Turn if-expressions whose arms cannot trap or call into selects.
+  bool IfConversion;
+  // Turn if-else chains that compare one pure expression with constants,
+  // if x = 1 then a else if x = 2 then b else c, into matches while
+  // parsing, so they become a single switch.
+  bool SwitchConversion;
+  // Generate only the functions reachable from the top-level expressions
+  // and from Exported_Names, codegen() leaves the number of the others in
+  // Skipped_Defns.
+  bool LazyCodegen;
+  std::vector<std::string> Exported_Names;
+  size_t Skipped_Defns;
+  // Emit debug info for Source_Name: every function gets a subprogram and
+  // the instructions the line and column of the expression they are for.
+  bool DebugInfo;
+  std::string Source_Name;
+  // Keep the optimization remarks of optimize() in Remarks.
+  bool CollectRemarks;
+  std::vector<Opt_Remark> Remarks;
+
+  // Debug info for code generation: a subprogram for the new function F
+  // defined at 'Line', which becomes the scope, and the location of the
+  // expression for the instructions that follow. Both do nothing without
+  // DebugInfo.
+  void beginDebugFunction(llvm::Function *F, unsigned Line);
+  void emitLocation(const BaseAST *Node);
+  llvm::DIScope *Debug_Scope;
+
+private:
+  void release_module();
+  std::vector<FunctionDefnAST *> parse_items(Lexer &lex);
+  llvm::Module *compile_defns(std::vector<FunctionDefnAST *> &Defns,
+                              bool codegen);
+  int next_token();
+  BaseAST *numeric_parser();
+  BaseAST *identifier_parser();
+  FunctionDeclAST *func_decl_parser();
+  FunctionDefnAST *func_defn_parser();
+  BaseAST *expression_parser();
+  BaseAST *paran_parser();
+  BaseAST *if_parser();
+  BaseAST *for_parser();
+  BaseAST *parallel_parser();
+  BaseAST *match_parser();
+  BaseAST *Base_Parser();
+  BaseAST *binary_op_parser(int old_prec, BaseAST *LHS);
+
+  // Hash-consing of the pure expressions of the item being parsed. The
+  // tables hold a reference to every node in them until the item is done.
+  BaseAST *intern_numeric(int Val);
+  BaseAST *intern_variable(const std::string &Name);
+  BaseAST *intern_binary(int Op, BaseAST *LHS, BaseAST *RHS);
+  void clear_interned();
+
+  void init_precedence();
+  int getBinOpPrecedence();
+  void HandleDefn();
+  void HandleTopExpression();
+  void Driver();
+
+  Lexer *Lex;
+  int Anon_Count;
+  // '|' ends the arm of a match rather than being an operator
+  bool In_Match_Arm;
+  // only while codegen() runs with DebugInfo
+  llvm::DIBuilder *DBuilder;
+  llvm::DICompileUnit *Debug_Unit;
+  std::vector<FunctionDefnAST *> Parsed;
+  std::map<int, BaseAST *> Numeric_Nodes;
+  std::map<std::string, BaseAST *> Variable_Nodes;
+  std::map<std::tuple<int, BaseAST *, BaseAST *>, BaseAST *> Binary_Nodes;
+};
+
+void delete_defns(std::vector<FunctionDefnAST *> &Defns);
+
+#endif
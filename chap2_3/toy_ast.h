@@ -0,0 +1,391 @@
+#ifndef TOY_AST_H
+#define TOY_AST_H
+
+#include <stdio.h>
+#include <assert.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "toy.h"
+
+namespace llvm {
+class Function;
+class Value;
+}
+
+class ExprMatchAST;
+class InterpCompiler;
+
+class BaseAST
+{
+  unsigned Refs;
+  unsigned Line, Col;
+
+public:
+  BaseAST(): Refs(1), Line(0), Col(0) {}
+  virtual ~BaseAST(){};
+
+  // The parser shares equal pure expressions between their parents, so
+  // parents drop their children with release() rather than delete.
+  BaseAST *retain() { 
+    ++Refs; 
+    return this; 
+  }
+  static void release(BaseAST *Node) {
+    if(Node && --Node->Refs == 0)
+      delete Node;
+  }
+
+  // Where the expression starts in the source, for a binary expression
+  // where the operator is. A shared node keeps the location of its first
+  // use.
+  void setLoc(unsigned line, unsigned col) {
+    if(Line == 0) {
+      Line = line;
+      Col = col;
+    }
+  }
+  unsigned getLine() const { return Line; }
+  unsigned getCol() const { return Col; }
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI) = 0;
+  // Emits bytecode for the interpreter, see toy_interp.cpp.
+  virtual unsigned interp_gen(InterpCompiler &IC) = 0;
+  // True if the expression can be evaluated even when its value is not
+  // needed: no calls, no loops and nothing that may trap.
+  virtual bool isSpeculatable() const { return false; }
+  // True if the expression has no side effects and does not branch, so
+  // equal expressions may share one node and, within a block, one value.
+  virtual bool isPure() const { return false; }
+  // Appends the functions the expression calls, user operators included.
+  virtual void collectCallees(std::vector<std::string> &Callees) const {}
+
+  // For the if-chain conversion of the parser: the value of a number, a
+  // comparison of some expression with a number, and the match itself.
+  virtual bool getNumber(int &Val) const { return false; }
+  virtual bool isEquality(BaseAST *&Subject, int &Val) const { return false; }
+  virtual ExprMatchAST *asMatch() { return 0; }
+};
+
+class VariableAST: public BaseAST
+{
+  std::string Var_Name;
+public:
+  VariableAST(std::string &name): Var_Name(name)
+  {
+  }
+  ~VariableAST()
+  {
+#ifdef DUMP_AST
+    std::cout << "VariableAST: " << Var_Name << std::endl;
+#endif
+  }
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual bool isSpeculatable() const { return true; }
+  virtual bool isPure() const { return true; }
+};
+
+class NumericAST: public BaseAST
+{
+  int numeric_val;
+public:
+  NumericAST(int val): numeric_val(val)
+  {
+  }
+  ~NumericAST()
+  {
+#ifdef DUMP_AST
+    std::cout << "NumericAST: " << numeric_val << std::endl;
+#endif
+  }
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual bool isSpeculatable() const { return true; }
+  virtual bool isPure() const { return true; }
+  virtual bool getNumber(int &Val) const {
+    Val = numeric_val;
+    return true;
+  }
+};
+
+class BinaryAST: public BaseAST
+{
+  std::string Bin_Operator;
+  BaseAST *LHS, *RHS;
+  bool Pure;
+
+public:
+  BinaryAST(std::string op, BaseAST *lhs, BaseAST *rhs);
+
+  ~BinaryAST()
+  {
+    release(LHS);
+    release(RHS);
+#ifdef DUMP_AST
+    printf("BinaryAST\n");
+#endif
+  }
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual bool isSpeculatable() const;
+  virtual bool isPure() const { return Pure; }
+  virtual void collectCallees(std::vector<std::string> &Callees) const;
+  virtual bool isEquality(BaseAST *&Subject, int &Val) const;
+};
+
+class FunctionDeclAST: public BaseAST {
+  std::string Func_name;
+  std::vector<std::string> Arguments;
+  bool isOperator;
+  unsigned Precedence;
+
+public:
+  FunctionDeclAST(const std::string &name, 
+                  const std::vector<std::string> &args,
+                  bool isoperator = false,
+                  unsigned prec = 0)
+      : Func_name(name), Arguments(args), 
+        isOperator(isoperator), Precedence(prec) {}
+
+  ~FunctionDeclAST() {
+#ifdef DUMP_AST
+    std::cout << "FunctionDeclAST: " << Func_name << std::endl;
+#endif
+  }
+
+  bool isUnaryOp() const {
+    return isOperator && Arguments.size() == 1;
+  }
+
+  bool isBinaryOp() const {
+    return isOperator && Arguments.size() == 2;
+  }
+
+  char getOperatorName() const {
+    assert(isUnaryOp() || isBinaryOp());
+    return Func_name[Func_name.size() - 1];
+  }
+
+  unsigned getBinaryPrecedence() const {
+    return Precedence;
+  }
+
+  const std::string &getName() const {
+    return Func_name;
+  }
+
+  void setName(const std::string &name) {
+    Func_name = name;
+  }
+
+  const std::vector<std::string> &getArgs() const {
+    return Arguments;
+  }
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+};
+
+class FunctionDefnAST: public BaseAST {
+  FunctionDeclAST *Func_Decl;
+  BaseAST *Body;
+  
+public:
+  FunctionDefnAST(FunctionDeclAST *proto, BaseAST *body): 
+  Func_Decl(proto), Body(body)
+  {
+  }
+
+  ~FunctionDefnAST()
+  {
+    if(Func_Decl)
+      delete Func_Decl;
+    release(Body);
+#ifdef DUMP_AST
+    printf("FunctionDefnAST\n");
+#endif
+  }
+
+  FunctionDeclAST *getDecl() const {
+    return Func_Decl;
+  }
+
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Body->collectCallees(Callees);
+  }
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+};
+
+class FunctionCallAST: public BaseAST
+{
+  std::string Function_Callee;
+  std::vector<BaseAST *> Function_Arguments;
+
+public:
+  FunctionCallAST(const std::string &callee, std::vector<BaseAST *> &args)
+      : Function_Callee(callee), Function_Arguments(args) {
+  }
+
+  ~FunctionCallAST() {
+    size_t len = Function_Arguments.size();
+    for(size_t idx = 0; idx < len; idx++)
+      release(Function_Arguments[idx]);
+#ifdef DUMP_AST
+    printf("FunctionCallAST\n");
+#endif
+  }
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Callees.push_back(Function_Callee);
+    for(size_t idx = 0; idx < Function_Arguments.size(); idx++)
+      Function_Arguments[idx]->collectCallees(Callees);
+  }
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+};
+
+class ExprIfAST : public BaseAST {
+  BaseAST *Cond, *Then, *Else;
+
+public:
+  ExprIfAST(BaseAST *cond, BaseAST *then, BaseAST *else_st)
+      : Cond(cond), Then(then), Else(else_st) {}
+  ~ExprIfAST() {
+    release(Cond);
+    release(Then);
+    release(Else);
+  }
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual bool isSpeculatable() const {
+    return Cond->isSpeculatable() && Then->isSpeculatable() && 
+           Else->isSpeculatable();
+  }
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Cond->collectCallees(Callees);
+    Then->collectCallees(Callees);
+    Else->collectCallees(Callees);
+  }
+};
+
+// match subject with N -> expr | N -> expr ... [| _ -> expr]
+//
+// Evaluates the subject once and then the arm of the first number equal to
+// it, or the '_' arm, 0 if there is none. The numbers are distinct, so the
+// arms become the cases of one switch.
+class ExprMatchAST : public BaseAST {
+  BaseAST *Subject;
+  std::vector<std::pair<int, BaseAST *> > Cases;
+  BaseAST *Default;
+
+public:
+  ExprMatchAST(BaseAST *subject, BaseAST *default_st)
+      : Subject(subject), Default(default_st) {}
+  ~ExprMatchAST() {
+    release(Subject);
+    for(size_t idx = 0; idx < Cases.size(); idx++)
+      release(Cases[idx].second);
+    release(Default);
+  }
+
+  BaseAST *getSubject() const { return Subject; }
+  bool hasCase(int Val) const {
+    for(size_t idx = 0; idx < Cases.size(); idx++)
+      if(Cases[idx].first == Val)
+        return true;
+    return false;
+  }
+  void addCase(int Val, BaseAST *Body) {
+    Cases.push_back(std::make_pair(Val, Body));
+  }
+  void setDefault(BaseAST *Body) {
+    release(Default);
+    Default = Body;
+  }
+  // Puts the arm in front of the others, it replaces an arm for the same
+  // number, as the test of an outer if comes first.
+  void prependCase(int Val, BaseAST *Body);
+
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual bool isSpeculatable() const;
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Subject->collectCallees(Callees);
+    for(size_t idx = 0; idx < Cases.size(); idx++)
+      Cases[idx].second->collectCallees(Callees);
+    if(Default)
+      Default->collectCallees(Callees);
+  }
+  virtual ExprMatchAST *asMatch() { return this; }
+};
+
+class ExprForAST : public BaseAST {
+  std::string Var_Name;
+  BaseAST *Start, *End, *Step, *Body;
+
+public:
+  ExprForAST(const std::string &varname, BaseAST *start, BaseAST *end,
+             BaseAST *step, BaseAST *body)
+      : Var_Name(varname), Start(start), End(end), Step(step), Body(body) {}
+  ~ExprForAST() {
+    release(Start);
+    release(End);
+    release(Step);
+    release(Body);
+  }
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Start->collectCallees(Callees);
+    End->collectCallees(Callees);
+    if(Step)
+      Step->collectCallees(Callees);
+    Body->collectCallees(Callees);
+  }
+};
+
+// parallel [op] for i = start, end [, step] in body
+//
+// Runs the body for i = start, start + step, ... while i < end, with 'end'
+// and 'step' evaluated once, and combines the values of the body with the
+// operator, '+' if none is given. The iterations are spread over the
+// threads of the runtime (toy_runtime.h), so the operator must be
+// associative; the value is 0 when there are no iterations.
+class ExprParallelForAST : public BaseAST {
+  std::string Var_Name;
+  BaseAST *Start, *End, *Step, *Body;
+  int Combiner;
+
+  llvm::Function *combine_gen(CompilerInstance &CI, const std::string &Name);
+
+public:
+  ExprParallelForAST(const std::string &varname, BaseAST *start,
+                     BaseAST *end, BaseAST *step, BaseAST *body,
+                     int combiner)
+      : Var_Name(varname), Start(start), End(end), Step(step), Body(body),
+        Combiner(combiner) {}
+  ~ExprParallelForAST() {
+    release(Start);
+    release(End);
+    release(Step);
+    release(Body);
+  }
+  virtual llvm::Value *code_gen(CompilerInstance &CI);
+  virtual unsigned interp_gen(InterpCompiler &IC);
+  virtual void collectCallees(std::vector<std::string> &Callees) const {
+    Start->collectCallees(Callees);
+    End->collectCallees(Callees);
+    if(Step)
+      Step->collectCallees(Callees);
+    Body->collectCallees(Callees);
+    if(Combiner != '+' && Combiner != '*')
+      Callees.push_back(std::string("binary") + (char)Combiner);
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+
+#include "toy.h"
+#include "toy_bench.h"
+#include "toy_interp.h"
+
+using namespace llvm;
+
+Bench_Mode::Bench_Mode()
+    : Name("O2"), Interp(false), OptLevel(2), IfConversion(false),
+      SwitchConversion(true), Specialize(false) {}
+
+Bench_Mode parseBenchMode(const std::string &Text) {
+  Bench_Mode Mode;
+  Mode.Name = Text;
+  if(Text == "interp") {
+    Mode.Interp = true;
+    return Mode;
+  }
+
+  check_cond(Text.size() >= 2 && Text[0] == 'O' && Text[1] >= '0' &&
+             Text[1] <= '3', "Error: unknown bench mode " + Text + ".\n");
+  Mode.OptLevel = Text[1] - '0';
+  for(size_t start = 2, end; start < Text.size(); start = end) {
+    end = Text.find('+', start + 1);
+    if(end == std::string::npos)
+      end = Text.size();
+    std::string Flag = Text.substr(start, end - start);
+    if(Flag == "+if")
+      Mode.IfConversion = true;
+    else if(Flag == "+noswitch")
+      Mode.SwitchConversion = false;
+    else if(Flag == "+spec")
+      Mode.Specialize = true;
+    else
+      check_cond(false, "Error: unknown bench mode " + Text + ".\n");
+  }
+  return Mode;
+}
+
+// i32 toy.bench(i32 *args) calls the function with the arguments in 'args'.
+// Added after optimize(), so the function is not inlined into it.
+static Function *create_thunk(CompilerInstance &CI, Function *F) {
+  LLVMContext &C = CI.context;
+  Type *I32 = Type::getInt32Ty(C);
+  Type *Params[1] = {Type::getInt32PtrTy(C)};
+  Function *Thunk = Function::Create(FunctionType::get(I32, Params, false),
+                                     Function::ExternalLinkage, "toy.bench",
+                                     CI.Module_ob);
+  Value *Args = &*Thunk->arg_begin();
+
+  IRBuilder<> B(BasicBlock::Create(C, "entry", Thunk));
+  std::vector<Value *> CallArgs;
+  for(unsigned idx = 0; idx != F->arg_size(); ++idx)
+    CallArgs.push_back(
+        B.CreateLoad(I32, B.CreateInBoundsGEP(I32, Args, B.getInt32(idx))));
+  B.CreateRet(B.CreateCall(F, CallArgs));
+  verifyFunction(*Thunk);
+  return Thunk;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start).count();
+}
+
+namespace {
+
+typedef int32_t (*Thunk_Fn)(const int32_t *);
+
+struct JIT_Call {
+  Thunk_Fn Thunk;
+  const int32_t *Args;
+  int32_t operator()() const { return Thunk(Args); }
+};
+
+struct Interp_Call {
+  const std::vector<Interp_Function> *Functions;
+  unsigned Fn;
+  const int32_t *Args;
+  int32_t operator()() const { return interpret(*Functions, Fn, Args); }
+};
+
+}
+
+// samples taken before the median is looked at again, and at least that
+// many in all for a p99 worth the name
+static const size_t Round_Samples = 25;
+static const size_t Min_Samples = 100;
+
+template <typename Call>
+static Bench_Result measure(Call call, const Bench_Options &Opts) {
+  Bench_Result Result;
+  Result.Value = call();
+
+  // doubling the calls per sample until one takes long enough also warms
+  // up the caches and the branch predictors
+  volatile int32_t Sink = 0;
+  uint64_t Calls = 1;
+  while(true) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(uint64_t idx = 0; idx < Calls; idx++)
+      Sink = call();
+    if(seconds_since(start) >= Opts.Min_Sample_Seconds)
+      break;
+    Calls *= 2;
+  }
+
+  std::vector<double> Samples;
+  std::vector<double> Sorted;
+  double Median = 0;
+  Result.Stable = false;
+  std::chrono::steady_clock::time_point begin =
+      std::chrono::steady_clock::now();
+  do {
+    for(size_t idx = 0; idx < Round_Samples; idx++) {
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      for(uint64_t call_idx = 0; call_idx < Calls; call_idx++)
+        Sink = call();
+      Samples.push_back(seconds_since(start) * 1e9 / Calls);
+    }
+
+    Sorted = Samples;
+    std::sort(Sorted.begin(), Sorted.end());
+    double Last = Median;
+    Median = Sorted[Sorted.size() / 2];
+    Result.Stable = Samples.size() >= Min_Samples &&
+                    fabs(Median - Last) <= Opts.Tolerance * Last;
+  } while(!Result.Stable && seconds_since(begin) < Opts.Max_Seconds);
+  (void)Sink;
+
+  Result.Calls_Per_Sample = Calls;
+  Result.Samples = Sorted.size();
+  Result.Min_ns = Sorted.front();
+  Result.Median_ns = Median;
+  Result.P99_ns = Sorted[(Sorted.size() * 99 + 99) / 100 - 1];
+  Result.Calls_Per_Sec = 1e9 / Median;
+  return Result;
+}
+
+static Bench_Result bench_interp(const std::string &source,
+                                 const std::string &name,
+                                 const std::vector<int32_t> &args,
+                                 const Bench_Options &Opts) {
+  CompilerInstance CI;
+  std::vector<FunctionDefnAST *> Defns =
+      CI.parseBuffer(source.data(), source.size());
+  InterpCompiler IC;
+  try {
+    IC.compile(Defns);
+  } catch(...) {
+    delete_defns(Defns);
+    throw;
+  }
+  delete_defns(Defns);
+
+  int Fn = IC.lookup(name);
+  check_cond(Fn >= 0, "Error: no function " + name + " defined!\n");
+  check_cond(IC.Functions[Fn].NumArgs == args.size(),
+             "Error: wrong number of arguments to " + name + "!\n");
+  Interp_Call Call = {&IC.Functions, (unsigned)Fn, args.data()};
+  return measure(Call, Opts);
+}
+
+Bench_Result benchFunction(const std::string &source, const std::string &name,
+                           const std::vector<int32_t> &args,
+                           const Bench_Mode &Mode,
+                           const Bench_Options &Opts) {
+  if(Mode.Interp)
+    return bench_interp(source, name, args, Opts);
+
+  CompilerInstance CI;
+  CI.IfConversion = Mode.IfConversion;
+  CI.SwitchConversion = Mode.SwitchConversion;
+  CI.LazyCodegen = true;
+  CI.Exported_Names.push_back(name);
+
+  Module *M = CI.compileBuffer(source.data(), source.size());
+  Function *F = M->getFunction(name);
+  check_cond(F != 0 && !F->empty(),
+             "Error: no function " + name + " defined!\n");
+  check_cond(F->arg_size() == args.size(),
+             "Error: wrong number of arguments to " + name + "!\n");
+  if(Mode.Specialize)
+    CI.specialize();
+
+  ExecutionEngine *EE = CI.createEngine();
+  if(Mode.OptLevel)
+    CI.optimize(Mode.OptLevel);
+  std::string Thunk = create_thunk(CI, F)->getName().str();
+
+  JIT_Call Call = {(Thunk_Fn)EE->getFunctionAddress(Thunk), args.data()};
+  check_cond(Call.Thunk != 0, "Error: unable to JIT " + name + "!\n");
+  return measure(Call, Opts);
+}
+
+bool pinToCPU(unsigned cpu) {
+#ifdef __linux__
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  CPU_SET(cpu, &Set);
+  return sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef TOY_BENCH_H
+#define TOY_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "toy.h"
+
+// How the function under test is compiled: "O0" to "O3", optionally with
+// "+if" (IfConversion), "+noswitch" (no SwitchConversion) and "+spec"
+// (CompilerInstance::specialize()), e.g. "O3+if+spec", or "interp" for the
+// bytecode interpreter. The JIT generates machine code the same way in all
+// of them, only the IR differs.
+struct Bench_Mode {
+  Bench_Mode();
+
+  std::string Name;
+  bool Interp;
+  unsigned OptLevel;
+  bool IfConversion;
+  bool SwitchConversion;
+  bool Specialize;
+};
+
+Bench_Mode parseBenchMode(const std::string &Text);
+
+struct Bench_Options {
+  Bench_Options() : Max_Seconds(5), Min_Sample_Seconds(2e-4),
+                    Tolerance(0.01) {}
+
+  // gives up on a stable median after this long
+  double Max_Seconds;
+  // every sample runs as many calls as take at least this long, so the
+  // clock resolution does not matter
+  double Min_Sample_Seconds;
+  // the median is stable once another round of samples moves it by less
+  // than this fraction
+  double Tolerance;
+};
+
+// The latencies are per call.
+struct Bench_Result {
+  int32_t Value;
+  uint64_t Calls_Per_Sample;
+  size_t Samples;
+  double Min_ns, Median_ns, P99_ns;
+  double Calls_Per_Sec;
+  bool Stable;
+};
+
+// Compiles 'source' in the given mode and calls the function 'name' with
+// 'args' over and over until the median latency is stable. For the JIT
+// modes the function is called through a thunk that loads the arguments
+// from memory, so the calls cannot be folded away.
+Bench_Result benchFunction(const std::string &source, const std::string &name,
+                           const std::vector<int32_t> &args,
+                           const Bench_Mode &Mode,
+                           const Bench_Options &Opts = Bench_Options());
+
+// Keeps the calling thread on one CPU, false if that is not possible.
+bool pinToCPU(unsigned cpu);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+
+// Client for 'toy --serve <socket>'.
+//
+//   toy_client [-j N] <socket> file.d ...   compile files on the server
+//   toy_client [-j N] <socket> -            compile stdin as a buffer
+//
+// Up to N requests are in flight at once, results are printed in the order
+// the inputs were given.
+
+static void check_cond(bool cond, std::string message) {
+  if (!cond) {
+    fprintf(stderr, "%s", message.c_str());
+    exit(1);
+  }
+  return;
+}
+
+static void write_full(int fd, const char *buf, size_t len) {
+  while(len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    check_cond(n > 0, "Error: unable to send request.\n");
+    buf += n;
+    len -= n;
+  }
+}
+
+static std::string read_stdin() {
+  std::string content;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), stdin)) > 0)
+    content.append(buf, n);
+  return content;
+}
+
+static int send_request(const char *sock_path, const std::string &input) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  check_cond(fd >= 0, "Error: unable to create socket.\n");
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  check_cond(strlen(sock_path) < sizeof(addr.sun_path),
+             "Error: socket path too long.\n");
+  strcpy(addr.sun_path, sock_path);
+  check_cond(connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0,
+             std::string("Error: unable to connect to ") + sock_path + ".\n");
+
+  std::string request;
+  if(input == "-") {
+    std::string content = read_stdin();
+    request = "BUF " + std::to_string(content.size()) + "\n" + content;
+  } else {
+    // the server may run in another working directory
+    char path[PATH_MAX];
+    check_cond(realpath(input.c_str(), path) != NULL,
+               "Error: unable to open " + input + ".\n");
+    request = std::string("FILE ") + path + "\n";
+  }
+  write_full(fd, request.data(), request.size());
+  shutdown(fd, SHUT_WR);
+  return fd;
+}
+
+static void print_reply(int fd) {
+  char buf[4096];
+  ssize_t n;
+  while((n = read(fd, buf, sizeof(buf))) != 0) {
+    if(n < 0 && errno == EINTR)
+      continue;
+    check_cond(n > 0, "Error: lost connection to server.\n");
+    fwrite(buf, 1, n, stdout);
+  }
+  close(fd);
+}
+
+int main(int argc, char **argv) {
+  size_t jobs = 16;
+  int arg = 1;
+  if(arg + 1 < argc && strcmp(argv[arg], "-j") == 0) {
+    jobs = strtoul(argv[arg + 1], 0, 10);
+    arg += 2;
+  }
+  check_cond(arg + 1 < argc && jobs > 0,
+             "Usage: toy_client [-j N] <socket> (file.d | -) ...\n");
+
+  const char *sock_path = argv[arg++];
+  std::vector<std::string> inputs(argv + arg, argv + argc);
+  std::vector<int> pending(inputs.size(), -1);
+
+  size_t next_send = 0;
+  for(size_t idx = 0; idx < inputs.size(); idx++) {
+    while(next_send < inputs.size() && next_send < idx + jobs) {
+      pending[next_send] = send_request(sock_path, inputs[next_send]);
+      next_send++;
+    }
+
+    if(inputs.size() > 1)
+      printf("; ==> %s <==\n", inputs[idx].c_str());
+    fflush(stdout);
+    print_reply(pending[idx]);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IR/IRBuilder.h>
+
+#include "toy_eval.h"
+
+using namespace llvm;
+
+// Emits a loop calling F for 'n' argument vectors. Row-wise, for the
+// batch function:
+//   void batch.F(const i32 *args, i32 *out, i64 n) {
+//     for (i = 0; i != n; ++i)
+//       out[i] = F(args[i*k], ..., args[i*k+k-1]);
+//   }
+// Column-wise, for the kernel:
+//   void F_vec(const i32 *a0, ..., const i32 *ak-1, i32 *out, i64 n) {
+//     for (i = 0; i != n; ++i)
+//       out[i] = F(a0[i], ..., ak-1[i]);
+//   }
+static Function *create_loop_function(CompilerInstance &CI, Function *F,
+                                      bool columns) {
+  LLVMContext &C = CI.context;
+  IRBuilder<> &B = CI.Builder;
+  Type *I32 = Type::getInt32Ty(C);
+  Type *I64 = Type::getInt64Ty(C);
+  unsigned NumArgs = F->arg_size();
+
+  std::vector<Type *> Params(columns ? NumArgs + 1 : 2,
+                             Type::getInt32PtrTy(C));
+  Params.push_back(I64);
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(C), Params, false);
+  std::string Name = columns ? F->getName().str() + "_vec"
+                             : "batch." + F->getName().str();
+  Function *Loop = Function::Create(FT, Function::ExternalLinkage, Name,
+                                    CI.Module_ob);
+
+  std::vector<Value *> Ptrs;
+  for(Function::arg_iterator arg_it = Loop->arg_begin();
+      arg_it != Loop->arg_end(); ++arg_it)
+    Ptrs.push_back(&*arg_it);
+  Value *N = Ptrs.back();
+  Ptrs.pop_back();
+  Value *Out = Ptrs.back();
+  Ptrs.pop_back();
+  // the kernel promises that the arrays do not overlap 'out', which saves
+  // the vectorizer its runtime checks
+  if(columns) {
+    for(Function::arg_iterator arg_it = Loop->arg_begin();
+        &*arg_it != N; ++arg_it)
+      arg_it->addAttr(Attribute::NoAlias);
+  }
+
+  BasicBlock *EntryBB = BasicBlock::Create(C, "entry", Loop);
+  BasicBlock *LoopBB = BasicBlock::Create(C, "loop", Loop);
+  BasicBlock *ExitBB = BasicBlock::Create(C, "exit", Loop);
+
+  B.SetInsertPoint(EntryBB);
+  B.CreateCondBr(B.CreateICmpEQ(N, ConstantInt::get(I64, 0)), ExitBB, LoopBB);
+
+  B.SetInsertPoint(LoopBB);
+  PHINode *Idx = B.CreatePHI(I64, 2, "i");
+  Idx->addIncoming(ConstantInt::get(I64, 0), EntryBB);
+
+  std::vector<Value *> CallArgs;
+  Value *Base = B.CreateMul(Idx, ConstantInt::get(I64, NumArgs), "base");
+  for(unsigned idx = 0; idx != NumArgs; ++idx) {
+    Value *Ptr;
+    if(columns)
+      Ptr = B.CreateInBoundsGEP(I32, Ptrs[idx], Idx);
+    else
+      Ptr = B.CreateInBoundsGEP(
+          I32, Ptrs[0], B.CreateAdd(Base, ConstantInt::get(I64, idx)));
+    CallArgs.push_back(B.CreateLoad(I32, Ptr));
+  }
+  Value *Result = B.CreateCall(F, CallArgs, "result");
+  B.CreateStore(Result, B.CreateInBoundsGEP(I32, Out, Idx));
+
+  Value *Next = B.CreateAdd(Idx, ConstantInt::get(I64, 1), "next");
+  Idx->addIncoming(Next, LoopBB);
+  B.CreateCondBr(B.CreateICmpEQ(Next, N), ExitBB, LoopBB);
+
+  B.SetInsertPoint(ExitBB);
+  B.CreateRetVoid();
+  B.ClearInsertionPoint();
+
+  verifyFunction(*Loop);
+  return Loop;
+}
+
+CompiledFunction CompiledFunction::jit(const std::string &source,
+                                       const std::string &name,
+                                       unsigned OptLevel, bool kernel) {
+  CompiledFunction CF;
+  CF.CI = std::make_shared<CompilerInstance>();
+  CompilerInstance &CI = *CF.CI;
+  CI.IfConversion = kernel;
+  // the rest of the source need not be compiled at all
+  CI.LazyCodegen = true;
+  CI.Exported_Names.push_back(name);
+
+  Module *M = CI.compileBuffer(source.data(), source.size());
+  Function *F = M->getFunction(name);
+  check_cond(F != 0 && !F->empty(),
+             "Error: no function " + name + " defined!\n");
+  std::string BatchName = create_loop_function(CI, F, false)->getName().str();
+  std::string KernelName;
+  if(kernel)
+    KernelName = create_loop_function(CI, F, true)->getName().str();
+  CF.NumArgs = F->arg_size();
+
+  // the engine sets the data layout the optimizer should see
+  ExecutionEngine *EE = CI.createEngine();
+  if(OptLevel)
+    CI.optimize(OptLevel);
+
+  CF.Native = (void *)EE->getFunctionAddress(name);
+  CF.Batch = (BatchFn)EE->getFunctionAddress(BatchName);
+  if(kernel)
+    CF.Kernel = (void *)EE->getFunctionAddress(KernelName);
+  check_cond(CF.Native != 0 && CF.Batch != 0 && (!kernel || CF.Kernel != 0),
+             "Error: unable to JIT " + name + "!\n");
+  return CF;
+}
+
+CompiledFunction compileFunction(const std::string &source,
+                                 const std::string &name,
+                                 unsigned OptLevel) {
+  return CompiledFunction::jit(source, name, OptLevel, false);
+}
+
+CompiledFunction compileKernel(const std::string &source,
+                               const std::string &name,
+                               unsigned OptLevel) {
+  return CompiledFunction::jit(source, name, OptLevel, true);
+}
+
+CompiledFunction compileExpression(const std::string &expr,
+                                   const std::vector<std::string> &args,
+                                   unsigned OptLevel) {
+  std::string source = "def evalexpr(";
+  for(size_t idx = 0; idx < args.size(); idx++) {
+    if(idx)
+      source += ", ";
+    source += args[idx];
+  }
+  source += ")\n" + expr + "\n";
+  return compileFunction(source, "evalexpr", OptLevel);
+}
+
+std::vector<int32_t> evalTopLevel(const char *buf, size_t len,
+                                  unsigned OptLevel) {
+  CompilerInstance CI;
+  CI.LazyCodegen = true;
+  Module *M = CI.compileBuffer(buf, len);
+
+  std::vector<std::string> Names;
+  for(Module::iterator F = M->begin(); F != M->end(); ++F) {
+    // the JIT would abort on an unresolved symbol
+    check_cond(!F->empty() || F->getName() == "toy_parallel_for", 
+               "Error: call to undefined function!\n");
+    // the bodies of their parallel loops are internal
+    if(F->getName().startswith("__anon_expr") && !F->hasLocalLinkage())
+      Names.push_back(F->getName().str());
+  }
+
+  ExecutionEngine *EE = CI.createEngine();
+  if(OptLevel)
+    CI.optimize(OptLevel);
+
+  std::vector<int32_t> Results;
+  for(size_t idx = 0; idx < Names.size(); idx++) {
+    int32_t (*Expr)() = (int32_t (*)())EE->getFunctionAddress(Names[idx]);
+    Results.push_back(Expr());
+  }
+  return Results;
+}
@@ -0,0 +1,90 @@
+#ifndef TOY_EVAL_H
+#define TOY_EVAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "toy.h"
+
+// A toy function compiled to native code. Copies share the same code, which
+// stays alive as long as any of them does.
+class CompiledFunction {
+public:
+  CompiledFunction() : Native(0), Kernel(0), Batch(0), NumArgs(0) {}
+
+  unsigned getNumArgs() const { return NumArgs; }
+
+  // The native entry point, e.g. get<int32_t, int32_t>() for a function
+  // of two arguments.
+  template <typename... Args> int32_t (*get() const)(Args...) {
+    check_cond(sizeof...(Args) == NumArgs,
+               "Error: wrong number of arguments for compiled function!\n");
+    return (int32_t (*)(Args...))Native;
+  }
+
+  // Evaluates the function for 'n' argument vectors. 'args' holds
+  // getNumArgs() values per vector, one vector after another, and 'out'
+  // gets one result per vector. The loop over the vectors is compiled
+  // together with the function, so each evaluation is a plain native call
+  // or gets inlined altogether.
+  void evalBatch(const int32_t *args, int32_t *out, size_t n) const {
+    Batch(args, out, n);
+  }
+
+  // Only for functions from compileKernel(): the element-wise kernel
+  //   void f_vec(const int32_t *x, const int32_t *y, int32_t *out, size_t n)
+  // computing out[i] = f(x[i], y[i]), e.g. getKernel<int32_t, int32_t>()
+  // for a function of two arguments. 'out' must not overlap the inputs.
+  template <typename... Args> 
+  void (*getKernel() const)(const Args *..., int32_t *, size_t) {
+    check_cond(Kernel != 0, "Error: function was not compiled as kernel!\n");
+    check_cond(sizeof...(Args) == NumArgs,
+               "Error: wrong number of arguments for compiled function!\n");
+    return (void (*)(const Args *..., int32_t *, size_t))Kernel;
+  }
+
+private:
+  typedef void (*BatchFn)(const int32_t *, int32_t *, uint64_t);
+
+  friend CompiledFunction compileFunction(const std::string &,
+                                          const std::string &, unsigned);
+  friend CompiledFunction compileKernel(const std::string &,
+                                        const std::string &, unsigned);
+  static CompiledFunction jit(const std::string &source,
+                              const std::string &name, unsigned OptLevel,
+                              bool kernel);
+
+  std::shared_ptr<CompilerInstance> CI;
+  void *Native;
+  void *Kernel;
+  BatchFn Batch;
+  unsigned NumArgs;
+};
+
+// Compiles the toy source and returns the function 'name' defined in it.
+CompiledFunction compileFunction(const std::string &source,
+                                 const std::string &name,
+                                 unsigned OptLevel = 2);
+
+// Like compileFunction(), but also builds the element-wise kernel
+// 'name'_vec. If-expressions are turned into selects where possible, so the
+// loop vectorizer can use the SIMD instructions of the host.
+CompiledFunction compileKernel(const std::string &source,
+                               const std::string &name,
+                               unsigned OptLevel = 3);
+
+// Compiles an expression such as "x + y * 16" into a function taking 'args'
+// in the given order.
+CompiledFunction compileExpression(const std::string &expr,
+                                   const std::vector<std::string> &args,
+                                   unsigned OptLevel = 2);
+
+// JIT-compiles the source and returns the values of its top-level
+// expressions.
+std::vector<int32_t> evalTopLevel(const char *buf, size_t len,
+                                  unsigned OptLevel = 0);
+
+#endif
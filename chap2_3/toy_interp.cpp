@@ -0,0 +1,476 @@
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "toy.h"
+#include "toy_ast.h"
+#include "toy_interp.h"
+
+unsigned InterpCompiler::alloc_reg() {
+  unsigned reg = Top++;
+  if(Top > Cur->NumRegs)
+    Cur->NumRegs = Top;
+  return reg;
+}
+
+size_t InterpCompiler::emit(Interp_Op Op, int32_t A, int32_t B, int32_t C) {
+  Interp_Insn Insn = {Op, A, B, C};
+  Cur->Code.push_back(Insn);
+  return Cur->Code.size() - 1;
+}
+
+int InterpCompiler::lookup(const std::string &name) const {
+  std::map<std::string, unsigned>::const_iterator it =
+      Function_Index.find(name);
+  return it == Function_Index.end() ? -1 : (int)it->second;
+}
+
+void InterpCompiler::compile(const std::vector<FunctionDefnAST *> &Defns) {
+  // all functions are known up front, so calls may go forward
+  for(size_t idx = 0; idx < Defns.size(); idx++) {
+    FunctionDeclAST *Decl = Defns[idx]->getDecl();
+    check_cond(lookup(Decl->getName()) < 0,
+               "Error: redefinition of function " + Decl->getName() + "!\n");
+    Function_Index[Decl->getName()] = Functions.size();
+
+    Interp_Function F;
+    F.Name = Decl->getName();
+    F.NumArgs = Decl->getArgs().size();
+    F.NumRegs = 0;
+    Functions.push_back(F);
+  }
+
+  for(size_t idx = 0; idx < Defns.size(); idx++)
+    Defns[idx]->interp_gen(*this);
+}
+
+unsigned VariableAST::interp_gen(InterpCompiler &IC) {
+  std::map<std::string, unsigned>::iterator it = IC.Named_Regs.find(Var_Name);
+  check_cond(it != IC.Named_Regs.end(),
+             "Error: unknown variable " + Var_Name + "!\n");
+  return it->second;
+}
+
+unsigned NumericAST::interp_gen(InterpCompiler &IC) {
+  unsigned dst = IC.alloc_reg();
+  IC.emit(OP_LOADK, dst, numeric_val);
+  return dst;
+}
+
+// Evaluates 'Args' into consecutive registers and calls 'Callee', the
+// result ends up in the first of them.
+static unsigned interp_gen_call(InterpCompiler &IC, const std::string &Callee,
+                                const std::vector<BaseAST *> &Args) {
+  int Fn = IC.lookup(Callee);
+  check_cond(Fn >= 0, "Error: unknown function " + Callee + "!\n");
+  check_cond(IC.Functions[Fn].NumArgs == Args.size(),
+             "Error: wrong number of arguments to " + Callee + "!\n");
+
+  unsigned base = IC.Top;
+  for(size_t idx = 0; idx < Args.size(); idx++)
+    IC.alloc_reg();
+  for(size_t idx = 0; idx < Args.size(); idx++) {
+    unsigned reg = Args[idx]->interp_gen(IC);
+    if(reg != base + idx)
+      IC.emit(OP_MOV, base + idx, reg);
+    IC.Top = base + Args.size();
+  }
+
+  IC.Top = base;
+  unsigned dst = IC.alloc_reg();
+  IC.emit(OP_CALL, dst, Fn, base);
+  return dst;
+}
+
+unsigned BinaryAST::interp_gen(InterpCompiler &IC) {
+  Interp_Op Op;
+  switch(atoi(Bin_Operator.c_str())) {
+    case '<': Op = OP_LT; break;
+    case '=': Op = OP_EQ; break;
+    case '+': Op = OP_ADD; break;
+    case '-': Op = OP_SUB; break;
+    case '*': Op = OP_MUL; break;
+    case '/': Op = OP_DIV; break;
+    default: {
+      std::vector<BaseAST *> Args;
+      Args.push_back(LHS);
+      Args.push_back(RHS);
+      return interp_gen_call(IC, std::string("binary") +
+                                 (char)atoi(Bin_Operator.c_str()), Args);
+    }
+  }
+
+  unsigned mark = IC.Top;
+  unsigned L = LHS->interp_gen(IC);
+  unsigned R = RHS->interp_gen(IC);
+  IC.Top = mark;
+  unsigned dst = IC.alloc_reg();
+  IC.emit(Op, dst, L, R);
+  return dst;
+}
+
+unsigned FunctionDeclAST::interp_gen(InterpCompiler &IC) {
+  IC.Named_Regs.clear();
+  IC.Top = 0;
+  for(size_t idx = 0; idx < Arguments.size(); idx++)
+    IC.Named_Regs[Arguments[idx]] = IC.alloc_reg();
+  return Arguments.size();
+}
+
+unsigned FunctionDefnAST::interp_gen(InterpCompiler &IC) {
+  int Fn = IC.lookup(Func_Decl->getName());
+  IC.Cur = &IC.Functions[Fn];
+  Func_Decl->interp_gen(IC);
+  unsigned result = Body->interp_gen(IC);
+  IC.emit(OP_RET, result);
+  IC.Cur = 0;
+  return Fn;
+}
+
+unsigned FunctionCallAST::interp_gen(InterpCompiler &IC) {
+  return interp_gen_call(IC, Function_Callee, Function_Arguments);
+}
+
+unsigned ExprIfAST::interp_gen(InterpCompiler &IC) {
+  unsigned mark = IC.Top;
+  unsigned cond = Cond->interp_gen(IC);
+  IC.Top = mark;
+  unsigned dst = IC.alloc_reg();
+  size_t jump_else = IC.emit(OP_JZ, cond);
+
+  unsigned then_reg = Then->interp_gen(IC);
+  if(then_reg != dst)
+    IC.emit(OP_MOV, dst, then_reg);
+  IC.Top = dst + 1;
+  size_t jump_end = IC.emit(OP_JMP);
+
+  IC.Cur->Code[jump_else].B = IC.here();
+  unsigned else_reg = Else->interp_gen(IC);
+  if(else_reg != dst)
+    IC.emit(OP_MOV, dst, else_reg);
+  IC.Top = dst + 1;
+
+  IC.Cur->Code[jump_end].A = IC.here();
+  return dst;
+}
+
+// There is no jump table in the bytecode, the subject is compared with the
+// cases one after another.
+unsigned ExprMatchAST::interp_gen(InterpCompiler &IC) {
+  unsigned dst = IC.alloc_reg();
+  unsigned subject = Subject->interp_gen(IC);
+  IC.Top = subject > dst ? subject + 1 : dst + 1;
+  unsigned key = IC.alloc_reg();
+  unsigned cond = IC.alloc_reg();
+
+  std::vector<size_t> jumps_case;
+  for(size_t idx = 0; idx < Cases.size(); idx++) {
+    IC.emit(OP_LOADK, key, Cases[idx].first);
+    IC.emit(OP_EQ, cond, subject, key);
+    jumps_case.push_back(IC.emit(OP_JNZ, cond));
+  }
+
+  std::vector<size_t> jumps_end;
+  IC.Top = dst + 1;
+  unsigned reg;
+  if(Default) {
+    reg = Default->interp_gen(IC);
+  } else {
+    reg = IC.alloc_reg();
+    IC.emit(OP_LOADK, reg, 0);
+  }
+  if(reg != dst)
+    IC.emit(OP_MOV, dst, reg);
+  jumps_end.push_back(IC.emit(OP_JMP));
+
+  for(size_t idx = 0; idx < Cases.size(); idx++) {
+    IC.Cur->Code[jumps_case[idx]].B = IC.here();
+    IC.Top = dst + 1;
+    reg = Cases[idx].second->interp_gen(IC);
+    if(reg != dst)
+      IC.emit(OP_MOV, dst, reg);
+    jumps_end.push_back(IC.emit(OP_JMP));
+  }
+
+  for(size_t idx = 0; idx < jumps_end.size(); idx++)
+    IC.Cur->Code[jumps_end[idx]].A = IC.here();
+  IC.Top = dst + 1;
+  return dst;
+}
+
+unsigned ExprForAST::interp_gen(InterpCompiler &IC) {
+  unsigned mark = IC.Top;
+  unsigned start = Start->interp_gen(IC);
+  IC.Top = mark;
+  unsigned var = IC.alloc_reg();
+  if(start != var)
+    IC.emit(OP_MOV, var, start);
+
+  bool had_old = IC.Named_Regs.count(Var_Name) != 0;
+  unsigned old_reg = had_old ? IC.Named_Regs[Var_Name] : 0;
+  IC.Named_Regs[Var_Name] = var;
+
+  // same order as the IR: body, step, then the end condition on the
+  // current value of the variable
+  size_t loop = IC.here();
+  Body->interp_gen(IC);
+  IC.Top = var + 1;
+  unsigned step;
+  if(Step) {
+    step = Step->interp_gen(IC);
+  } else {
+    step = IC.alloc_reg();
+    IC.emit(OP_LOADK, step, 1);
+  }
+  unsigned next = IC.alloc_reg();
+  IC.emit(OP_ADD, next, var, step);
+  unsigned end = End->interp_gen(IC);
+  IC.emit(OP_MOV, var, next);
+  IC.emit(OP_JNZ, end, loop);
+
+  if(had_old)
+    IC.Named_Regs[Var_Name] = old_reg;
+  else
+    IC.Named_Regs.erase(Var_Name);
+
+  IC.Top = mark;
+  unsigned dst = IC.alloc_reg();
+  IC.emit(OP_LOADK, dst, 0);
+  return dst;
+}
+
+// Runs the iterations one after another. The loop goes on while
+// step < end - i, which is i + step < end without the overflow.
+unsigned ExprParallelForAST::interp_gen(InterpCompiler &IC) {
+  int Fn = -1;
+  if(Combiner != '+' && Combiner != '*') {
+    std::string Name = std::string("binary") + (char)Combiner;
+    Fn = IC.lookup(Name);
+    check_cond(Fn >= 0, "Error: unknown function " + Name + "!\n");
+  }
+
+  unsigned mark = IC.Top;
+  unsigned var = IC.alloc_reg();
+  unsigned end = IC.alloc_reg();
+  unsigned step = IC.alloc_reg();
+  unsigned acc = IC.alloc_reg();
+  unsigned first = IC.alloc_reg();
+  unsigned top = IC.Top;
+
+  unsigned reg = Start->interp_gen(IC);
+  IC.emit(OP_MOV, var, reg);
+  IC.Top = top;
+  reg = End->interp_gen(IC);
+  IC.emit(OP_MOV, end, reg);
+  IC.Top = top;
+  if(Step) {
+    reg = Step->interp_gen(IC);
+    IC.emit(OP_MOV, step, reg);
+    IC.Top = top;
+  } else {
+    IC.emit(OP_LOADK, step, 1);
+  }
+  IC.emit(OP_LOADK, acc, 0);
+  IC.emit(OP_LOADK, first, 1);
+
+  std::vector<size_t> jumps_done;
+  jumps_done.push_back(IC.emit(OP_JZ, step));
+  unsigned cond = IC.alloc_reg();
+  IC.emit(OP_LT, cond, var, end);
+  jumps_done.push_back(IC.emit(OP_JZ, cond));
+  IC.Top = top;
+
+  bool had_old = IC.Named_Regs.count(Var_Name) != 0;
+  unsigned old_reg = had_old ? IC.Named_Regs[Var_Name] : 0;
+  IC.Named_Regs[Var_Name] = var;
+
+  size_t loop = IC.here();
+  unsigned val = Body->interp_gen(IC);
+  size_t jump_combine = IC.emit(OP_JZ, first);
+  IC.emit(OP_MOV, acc, val);
+  IC.emit(OP_LOADK, first, 0);
+  size_t jump_next = IC.emit(OP_JMP);
+
+  IC.Cur->Code[jump_combine].B = IC.here();
+  if(Combiner == '+') {
+    IC.emit(OP_ADD, acc, acc, val);
+  } else if(Combiner == '*') {
+    IC.emit(OP_MUL, acc, acc, val);
+  } else {
+    unsigned base = IC.alloc_reg();
+    IC.alloc_reg();
+    IC.emit(OP_MOV, base, acc);
+    IC.emit(OP_MOV, base + 1, val);
+    IC.emit(OP_CALL, base, Fn, base);
+    IC.emit(OP_MOV, acc, base);
+  }
+
+  IC.Cur->Code[jump_next].A = IC.here();
+  IC.Top = top;
+  unsigned left = IC.alloc_reg();
+  IC.emit(OP_SUB, left, end, var);
+  cond = IC.alloc_reg();
+  IC.emit(OP_LT, cond, step, left);
+  jumps_done.push_back(IC.emit(OP_JZ, cond));
+  IC.emit(OP_ADD, var, var, step);
+  IC.emit(OP_JMP, loop);
+
+  for(size_t idx = 0; idx < jumps_done.size(); idx++)
+    IC.Cur->Code[jumps_done[idx]].B = IC.here();
+  if(had_old)
+    IC.Named_Regs[Var_Name] = old_reg;
+  else
+    IC.Named_Regs.erase(Var_Name);
+
+  IC.Top = mark;
+  unsigned dst = IC.alloc_reg();
+  IC.emit(OP_MOV, dst, acc);
+  return dst;
+}
+
+int32_t interpret(const std::vector<Interp_Function> &Functions, unsigned Fn,
+                  const int32_t *Args) {
+  struct Frame {
+    const Interp_Function *F;
+    const Interp_Insn *Ret_PC;
+    size_t Base;
+    int32_t Dst;
+  };
+  const size_t Max_Depth = 1 << 20;
+
+  std::vector<int32_t> Stack(1024);
+  std::vector<Frame> Frames;
+
+  const Interp_Function *F = &Functions[Fn];
+  size_t Base = 0;
+  if(Stack.size() < F->NumRegs)
+    Stack.resize(F->NumRegs);
+  for(unsigned idx = 0; idx < F->NumArgs; idx++)
+    Stack[idx] = Args[idx];
+
+  int32_t *R = &Stack[0];
+  const Interp_Insn *Code = &F->Code[0];
+  const Interp_Insn *PC = Code;
+
+  // threaded dispatch: every handler jumps straight to the next one
+#if defined(__GNUC__)
+  static const void *Labels[] = {
+    &&L_OP_LOADK, &&L_OP_MOV, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV,
+    &&L_OP_LT, &&L_OP_EQ, &&L_OP_JMP, &&L_OP_JZ, &&L_OP_JNZ, &&L_OP_CALL, &&L_OP_RET
+  };
+#define DISPATCH() goto *Labels[PC->Op]
+#define TARGET(op) L_##op:
+#else
+#define DISPATCH() goto dispatch
+#define TARGET(op) case op:
+#endif
+
+  DISPATCH();
+#if !defined(__GNUC__)
+dispatch:
+  switch(PC->Op) {
+#endif
+  TARGET(OP_LOADK)
+    R[PC->A] = PC->B;
+    ++PC;
+    DISPATCH();
+  TARGET(OP_MOV)
+    R[PC->A] = R[PC->B];
+    ++PC;
+    DISPATCH();
+  TARGET(OP_ADD)
+    R[PC->A] = (int32_t)((uint32_t)R[PC->B] + (uint32_t)R[PC->C]);
+    ++PC;
+    DISPATCH();
+  TARGET(OP_SUB)
+    R[PC->A] = (int32_t)((uint32_t)R[PC->B] - (uint32_t)R[PC->C]);
+    ++PC;
+    DISPATCH();
+  TARGET(OP_MUL)
+    R[PC->A] = (int32_t)((uint32_t)R[PC->B] * (uint32_t)R[PC->C]);
+    ++PC;
+    DISPATCH();
+  TARGET(OP_DIV)
+    check_cond(R[PC->C] != 0, "Error: division by zero!\n");
+    R[PC->A] = (int32_t)((uint32_t)R[PC->B] / (uint32_t)R[PC->C]);
+    ++PC;
+    DISPATCH();
+  TARGET(OP_LT)
+    R[PC->A] = (uint32_t)R[PC->B] < (uint32_t)R[PC->C];
+    ++PC;
+    DISPATCH();
+  TARGET(OP_EQ)
+    R[PC->A] = R[PC->B] == R[PC->C];
+    ++PC;
+    DISPATCH();
+  TARGET(OP_JMP)
+    PC = Code + PC->A;
+    DISPATCH();
+  TARGET(OP_JZ)
+    PC = R[PC->A] == 0 ? Code + PC->B : PC + 1;
+    DISPATCH();
+  TARGET(OP_JNZ)
+    PC = R[PC->A] != 0 ? Code + PC->B : PC + 1;
+    DISPATCH();
+  TARGET(OP_CALL) {
+    const Interp_Function *Callee = &Functions[PC->B];
+    check_cond(Frames.size() < Max_Depth, "Error: stack overflow!\n");
+    size_t New_Base = Base + F->NumRegs;
+    if(Stack.size() < New_Base + Callee->NumRegs) {
+      Stack.resize(2 * (New_Base + Callee->NumRegs));
+      R = &Stack[Base];
+    }
+    for(unsigned idx = 0; idx < Callee->NumArgs; idx++)
+      Stack[New_Base + idx] = R[PC->C + idx];
+
+    Frame Caller = {F, PC + 1, Base, PC->A};
+    Frames.push_back(Caller);
+    F = Callee;
+    Base = New_Base;
+    R = &Stack[Base];
+    Code = PC = &F->Code[0];
+    DISPATCH();
+  }
+  TARGET(OP_RET) {
+    int32_t Result = R[PC->A];
+    if(Frames.empty())
+      return Result;
+
+    Frame &Caller = Frames.back();
+    F = Caller.F;
+    Base = Caller.Base;
+    R = &Stack[Base];
+    R[Caller.Dst] = Result;
+    Code = &F->Code[0];
+    PC = Caller.Ret_PC;
+    Frames.pop_back();
+    DISPATCH();
+  }
+#if !defined(__GNUC__)
+  }
+#endif
+#undef DISPATCH
+#undef TARGET
+  return 0;
+}
+
+std::vector<int32_t> interpretTopLevel(const char *buf, size_t len) {
+  CompilerInstance CI;
+  std::vector<FunctionDefnAST *> Defns = CI.parseBuffer(buf, len);
+
+  InterpCompiler IC;
+  try {
+    IC.compile(Defns);
+  } catch(...) {
+    delete_defns(Defns);
+    throw;
+  }
+  delete_defns(Defns);
+
+  std::vector<int32_t> Results;
+  for(size_t idx = 0; idx < IC.Functions.size(); idx++) {
+    if(IC.Functions[idx].Name.compare(0, 11, "__anon_expr") == 0)
+      Results.push_back(interpret(IC.Functions, idx, 0));
+  }
+  return Results;
+}
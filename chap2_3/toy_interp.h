@@ -0,0 +1,80 @@
+#ifndef TOY_INTERP_H
+#define TOY_INTERP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "toy.h"
+
+// A register based bytecode compiled straight from the AST, for scripts too
+// small to be worth the LLVM setup and code generation.
+//
+// Each function has NumRegs registers, the arguments come first. All
+// arithmetic is on 32 bit integers with the semantics of the generated IR:
+// wrapping + - *, unsigned / and <, and =.
+enum Interp_Op {
+  OP_LOADK = 0, // A = B
+  OP_MOV,       // A = reg B
+  OP_ADD,       // A = reg B + reg C
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_LT,
+  OP_EQ,
+  OP_JMP,       // goto A
+  OP_JZ,        // if reg A == 0 goto B
+  OP_JNZ,       // if reg A != 0 goto B
+  OP_CALL,      // A = function B (reg C, reg C + 1, ...)
+  OP_RET        // return reg A
+};
+
+struct Interp_Insn {
+  int32_t Op, A, B, C;
+};
+
+struct Interp_Function {
+  std::string Name;
+  unsigned NumArgs;
+  unsigned NumRegs;
+  std::vector<Interp_Insn> Code;
+};
+
+// Compiles parsed functions to bytecode, the AST nodes do their part in
+// their interp_gen() methods.
+class InterpCompiler {
+public:
+  InterpCompiler() : Cur(0), Top(0) {}
+
+  void compile(const std::vector<FunctionDefnAST *> &Defns);
+
+  // index of the function, or -1
+  int lookup(const std::string &name) const;
+
+  std::vector<Interp_Function> Functions;
+
+  // state of the function being compiled
+  Interp_Function *Cur;
+  std::map<std::string, unsigned> Named_Regs;
+  unsigned Top;
+
+  unsigned alloc_reg();
+  size_t emit(Interp_Op Op, int32_t A = 0, int32_t B = 0, int32_t C = 0);
+  size_t here() const { return Cur->Code.size(); }
+
+private:
+  std::map<std::string, unsigned> Function_Index;
+};
+
+// Runs function 'Fn' with its arguments in 'Args'. Run time errors
+// (division by zero, too deep recursion) are thrown as CompileError.
+int32_t interpret(const std::vector<Interp_Function> &Functions, unsigned Fn,
+                  const int32_t *Args);
+
+// Parses the source, compiles it to bytecode and returns the values of its
+// top-level expressions.
+std::vector<int32_t> interpretTopLevel(const char *buf, size_t len);
+
+#endif
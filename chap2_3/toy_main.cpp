@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "toy.h"
+#include "toy_bench.h"
+#include "toy_eval.h"
+#include "toy_interp.h"
+#include "toy_stream.h"
+
+using namespace llvm;
+
+static bool read_file(const char *path, std::string &content) {
+  FILE *file = fopen(path, "r");
+  if(file == NULL)
+    return false;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    content.append(buf, n);
+  fclose(file);
+  return true;
+}
+
+// With 'Exported' set, only what the top-level expressions and the
+// exported functions use is compiled and the skipped count is reported.
+// 'Specialize' clones the functions for their constant arguments, see
+// CompilerInstance::specialize().
+static void compile_and_print(const std::string &source, raw_ostream &OS,
+                              const std::vector<std::string> *Exported = 0,
+                              bool Specialize = false) {
+  CompilerInstance CI;
+  if(Exported) {
+    CI.LazyCodegen = true;
+    CI.Exported_Names = *Exported;
+  }
+  Module *M;
+  unsigned Clones = 0;
+  try {
+    M = CI.compileBuffer(source.data(), source.size());
+    if(Specialize)
+      Clones = CI.specialize();
+  } catch(CompileError &E) {
+    OS << E.what();
+    return;
+  }
+
+  OS << "================================\n";
+  M->print(OS, nullptr);
+  if(Exported)
+    fprintf(stderr, "toy: skipped %zu unreachable functions\n", 
+            CI.Skipped_Defns);
+  if(Specialize)
+    fprintf(stderr, "toy: %u specialized clones\n", Clones);
+}
+
+static std::string json_string(const std::string &str) {
+  std::string Result = "\"";
+  for(size_t idx = 0; idx < str.size(); idx++) {
+    unsigned char c = str[idx];
+    if(c == '"' || c == '\\') {
+      Result += '\\';
+      Result += c;
+    } else if(c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      Result += buf;
+    } else {
+      Result += c;
+    }
+  }
+  return Result + "\"";
+}
+
+// Compiles the file with debug info and writes the remarks of the -O<level>
+// pipeline as a JSON object keyed by "file:line", in source order:
+//   {"f.d:3": [{"kind": "missed", "pass": "inline", ...}, ...], ...}
+// Remarks without a location go under "<unknown>".
+static void write_remarks(const char *path, unsigned OptLevel, const char *output) {
+  std::string source;
+  check_cond(read_file(path, source), 
+             std::string("Error: unable to open ") + path + ".\n");
+
+  CompilerInstance CI;
+  CI.DebugInfo = true;
+  CI.Source_Name = path;
+  CI.CollectRemarks = true;
+  CI.compileBuffer(source.data(), source.size());
+  // the engine brings the cost models of the host
+  CI.createEngine();
+  CI.optimize(OptLevel);
+
+  std::map<std::pair<std::string, unsigned>, std::vector<const Opt_Remark *> >
+      By_Line;
+  size_t Counts[3] = {0, 0, 0};
+  for(size_t idx = 0; idx < CI.Remarks.size(); idx++) {
+    const Opt_Remark &R = CI.Remarks[idx];
+    By_Line[std::make_pair(R.File, R.Line)].push_back(&R);
+    Counts[R.Kind == "passed" ? 0 : R.Kind == "missed" ? 1 : 2]++;
+  }
+
+  std::error_code EC;
+#if LLVM_VERSION_MAJOR < 7
+  raw_fd_ostream OS(output, EC, sys::fs::F_None);
+#else
+  raw_fd_ostream OS(output, EC, sys::fs::OF_None);
+#endif
+  check_cond(!EC, std::string("Error: unable to open ") + output + ".\n");
+  OS << "{";
+  std::map<std::pair<std::string, unsigned>, 
+           std::vector<const Opt_Remark *> >::iterator it;
+  for(it = By_Line.begin(); it != By_Line.end(); ++it) {
+    std::string Key = it->first.second ? it->first.first + ":" + 
+                      std::to_string(it->first.second) : "<unknown>";
+    OS << (it == By_Line.begin() ? "\n  " : ",\n  ") << json_string(Key) 
+       << ": [";
+    for(size_t idx = 0; idx < it->second.size(); idx++) {
+      const Opt_Remark &R = *it->second[idx];
+      OS << (idx ? ",\n    " : "\n    ") << "{\"kind\": " 
+         << json_string(R.Kind) << ", \"pass\": " << json_string(R.Pass) 
+         << ", \"name\": " << json_string(R.Name) << ", \"function\": " 
+         << json_string(R.Function) << ", \"column\": " << R.Col 
+         << ", \"message\": " << json_string(R.Message) << "}";
+    }
+    OS << "\n  ]";
+  }
+  OS << "\n}\n";
+  OS.flush();
+
+  fprintf(stderr, "toy: %zu remarks, %zu passed, %zu missed, %zu analysis\n",
+          CI.Remarks.size(), Counts[0], Counts[1], Counts[2]);
+}
+
+static std::string format_ns(double ns) {
+  char buf[32];
+  if(ns < 1e3)
+    snprintf(buf, sizeof(buf), "%.2f ns", ns);
+  else if(ns < 1e6)
+    snprintf(buf, sizeof(buf), "%.2f us", ns / 1e3);
+  else if(ns < 1e9)
+    snprintf(buf, sizeof(buf), "%.2f ms", ns / 1e6);
+  else
+    snprintf(buf, sizeof(buf), "%.2f s", ns / 1e9);
+  return buf;
+}
+
+// --bench [--modes m1,m2,...] [--cpu <n>] [--time <seconds>]
+//         <file.d> <function> [<args>...]
+// Runs the function in every mode (see Bench_Mode, O0 and O2 by default)
+// and prints one line per mode, so they can be compared side by side.
+static void bench(int argc, char **argv) {
+  std::vector<Bench_Mode> Modes;
+  Bench_Options Opts;
+  int arg = 2;
+  while(arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] == '-') {
+    std::string opt = argv[arg];
+    std::string value = argv[arg + 1];
+    if(opt == "--modes") {
+      for(size_t start = 0, end; start <= value.size(); start = end + 1) {
+        end = value.find(',', start);
+        if(end == std::string::npos)
+          end = value.size();
+        if(end > start)
+          Modes.push_back(parseBenchMode(value.substr(start, end - start)));
+      }
+    } else if(opt == "--cpu") {
+      unsigned cpu = strtoul(value.c_str(), 0, 10);
+      check_cond(pinToCPU(cpu), 
+                 "Error: unable to pin to cpu " + value + ".\n");
+      fprintf(stderr, "toy: pinned to cpu %u\n", cpu);
+    } else if(opt == "--time") {
+      char *end;
+      Opts.Max_Seconds = strtod(value.c_str(), &end);
+      check_cond(!value.empty() && *end == 0 && Opts.Max_Seconds > 0,
+                 "Error: --time needs a positive number of seconds.\n");
+    } else {
+      check_cond(false, "Error: unknown option " + opt + ".\n");
+    }
+    arg += 2;
+  }
+  check_cond(arg + 1 < argc, "Error: --bench needs a file and a function.\n");
+  if(Modes.empty()) {
+    Modes.push_back(parseBenchMode("O0"));
+    Modes.push_back(parseBenchMode("O2"));
+  }
+
+  std::string source;
+  check_cond(read_file(argv[arg], source), 
+             std::string("Error: unable to open ") + argv[arg] + ".\n");
+  std::string name = argv[arg + 1];
+  std::vector<int32_t> args;
+  std::string call = name + "(";
+  for(int idx = arg + 2; idx < argc; idx++) {
+    args.push_back((int32_t)strtol(argv[idx], 0, 10));
+    call += std::string(idx > arg + 2 ? ", " : "") + argv[idx];
+  }
+  call += ")";
+
+  bool unstable = false;
+  int32_t expected = 0;
+  for(size_t idx = 0; idx < Modes.size(); idx++) {
+    Bench_Result R = benchFunction(source, name, args, Modes[idx], Opts);
+    if(idx == 0) {
+      expected = R.Value;
+      printf("%-16s %12s %12s %12s %14s %8s\n", call.c_str(), "min", 
+             "median", "p99", "calls/s", "samples");
+    }
+    unstable = unstable || !R.Stable;
+    printf("%-16s %12s %12s %12s %14.0f %8zu%s%s\n", 
+           Modes[idx].Name.c_str(), format_ns(R.Min_ns).c_str(), 
+           format_ns(R.Median_ns).c_str(), format_ns(R.P99_ns).c_str(), 
+           R.Calls_Per_Sec, R.Samples, R.Stable ? "" : " *",
+           R.Value == expected ? "" : "  MISMATCH");
+    fflush(stdout);
+  }
+  printf("= %d\n", expected);
+  if(unstable)
+    printf("* the median did not settle within %g s\n", Opts.Max_Seconds);
+}
+
+static bool read_full(int fd, char *buf, size_t len) {
+  while(len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Request format, one per connection:
+//   "FILE <path>\n"           compile a file visible to the server
+//   "BUF <len>\n<len bytes>"  compile an in-memory buffer
+// The reply is exactly what './build/toy <file>' prints; the server closes
+// the connection when the compilation is done.
+static const size_t Max_Header_Size = 4096;
+static const size_t Max_Request_Size = 64 << 20;
+
+static void handle_request(int conn) {
+  std::string header;
+  char c;
+  while(header.size() < Max_Header_Size && read_full(conn, &c, 1) && 
+        c != '\n')
+    header += c;
+
+  raw_fd_ostream OS(conn, /*shouldClose=*/true);
+  // whatever goes wrong with one request must not take the server down
+  try {
+    if(header.size() >= Max_Header_Size) {
+      OS << "Error: request header too long.\n";
+    } else if(header.compare(0, 5, "FILE ") == 0) {
+      std::string source;
+      if(!read_file(header.c_str() + 5, source))
+        OS << "Error: unable to open " << header.substr(5) << ".\n";
+      else
+        compile_and_print(source, OS);
+    } else if(header.compare(0, 4, "BUF ") == 0) {
+      const char *len_str = header.c_str() + 4;
+      char *end;
+      errno = 0;
+      unsigned long long len = strtoull(len_str, &end, 10);
+      if(end == len_str || *end != 0 || *len_str == '-' || errno != 0 ||
+         len > Max_Request_Size) {
+        OS << "Error: bad buffer length '" << len_str << "', at most " 
+           << Max_Request_Size << " bytes.\n";
+      } else {
+        std::string buf(len, '\0');
+        if(buf.empty() || read_full(conn, &buf[0], buf.size()))
+          compile_and_print(buf, OS);
+        else
+          OS << "Error: truncated buffer request.\n";
+      }
+    } else {
+      OS << "Error: bad request '" << header << "'.\n";
+    }
+  } catch(std::bad_alloc &) {
+    OS << "Error: out of memory.\n";
+  } catch(std::exception &E) {
+    OS << "Error: " << E.what() << "\n";
+  }
+  // the client may have gone away, that is not fatal for the server
+  OS.flush();
+  OS.clear_error();
+}
+
+// Requests compiled at the same time, further connections wait in the
+// listen backlog.
+static const unsigned Max_Requests = 16;
+static std::mutex Requests_Lock;
+static std::condition_variable Request_Done;
+static unsigned Active_Requests = 0;
+
+static void run_request(int conn) {
+  handle_request(conn);
+  std::lock_guard<std::mutex> Guard(Requests_Lock);
+  Active_Requests--;
+  Request_Done.notify_one();
+}
+
+// Every request is compiled on a thread of its own with its own
+// CompilerInstance (and so its own LLVMContext).
+static int serve(const char *path) {
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  check_cond(listen_fd >= 0, "Error: unable to create socket.\n");
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  check_cond(strlen(path) < sizeof(addr.sun_path),
+             "Error: socket path too long.\n");
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  check_cond(bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == 0,
+             std::string("Error: unable to bind ") + path + ".\n");
+  check_cond(listen(listen_fd, SOMAXCONN) == 0,
+             "Error: unable to listen on socket.\n");
+  // a client going away must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  printf("toy: serving on %s\n", path);
+  fflush(stdout);
+
+  while(true) {
+    {
+      std::unique_lock<std::mutex> Guard(Requests_Lock);
+      while(Active_Requests >= Max_Requests)
+        Request_Done.wait(Guard);
+    }
+    int conn = accept(listen_fd, NULL, NULL);
+    if(conn < 0) {
+      if(errno == EINTR)
+        continue;
+      perror("accept");
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> Guard(Requests_Lock);
+    Active_Requests++;
+    std::thread(run_request, conn).detach();
+  }
+}
+
+// Below this size the interpreter is done before the JIT is even set up.
+static const size_t Interp_Max_Size = 16 * 1024;
+
+// Evaluates the top-level expressions of the file.
+static void run(const char *path, const std::string &mode) {
+  std::string source;
+  if(!read_file(path, source)) {
+    printf("Error: unable to open %s.\n", path);
+    return;
+  }
+
+  bool interp = mode == "--interp" || 
+                (mode != "--jit" && source.size() < Interp_Max_Size);
+  std::vector<int32_t> Results = 
+      interp ? interpretTopLevel(source.data(), source.size())
+             : evalTopLevel(source.data(), source.size());
+  for(size_t idx = 0; idx < Results.size(); idx++)
+    printf("Evaluated to %d\n", Results[idx]);
+}
+
+// Writes the code of the file out chunk by chunk, see compileStreaming().
+static void stream(int argc, char **argv) {
+  Emit_Kind Kind = EMIT_IR;
+  int arg = 2;
+  if(arg < argc && std::string(argv[arg]) == "--bc") {
+    Kind = EMIT_BITCODE;
+    arg++;
+  } else if(arg < argc && std::string(argv[arg]) == "--obj") {
+    Kind = EMIT_OBJECT;
+    arg++;
+  }
+  check_cond(arg < argc, "Error: --stream needs a file.\n");
+  std::string Output = arg + 1 < argc ? argv[arg + 1] : "-";
+  check_cond(Kind == EMIT_IR || Output != "-", 
+             "Error: --bc and --obj need an output name.\n");
+
+  FILE *file = fopen(argv[arg], "r");
+  check_cond(file != NULL, std::string("Error: unable to open ") + 
+                           argv[arg] + ".\n");
+  Lexer lex(file);
+  Stream_Stats Stats;
+  try {
+    Stats = compileStreaming(lex, Kind, Output);
+  } catch(...) {
+    fclose(file);
+    throw;
+  }
+  fclose(file);
+
+  outs().flush();
+  fprintf(stderr, "toy: %zu functions in %zu chunks, peak RSS %ld KB\n", 
+          Stats.Functions, Stats.Chunks, Stats.Peak_RSS_KB);
+}
+
+int main(int argc, char **argv) {
+  try {
+    check_cond(argc >= 2,
+               "Usage: toy <file.d>\n"
+               "       toy --run [--interp | --jit] <file.d>\n"
+               "       toy --stream [--bc | --obj] <file.d> [<output>]\n"
+               "       toy --lazy [--export f,g,...] <file.d>\n"
+               "       toy --specialize <file.d>\n"
+               "       toy --remarks [-O<n>] <file.d> [<output.json>]\n"
+               "       toy --bench [--modes O0,O2,...] [--cpu <n>] "
+               "[--time <s>] <file.d> <fn> [<args>...]\n"
+               "       toy --serve <socket>\n");
+
+    if(std::string(argv[1]) == "--serve") {
+      check_cond(argc >= 3, "Error: --serve needs a socket path.\n");
+      return serve(argv[2]);
+    }
+
+    if(std::string(argv[1]) == "--run") {
+      check_cond(argc >= 3, "Error: --run needs a file.\n");
+      std::string mode = argc >= 4 ? argv[2] : "";
+      check_cond(mode == "" || mode == "--interp" || mode == "--jit",
+                 "Error: unknown option " + mode + ".\n");
+      run(argv[argc - 1], mode);
+      return 0;
+    }
+
+    if(std::string(argv[1]) == "--stream") {
+      stream(argc, argv);
+      return 0;
+    }
+
+    if(std::string(argv[1]) == "--bench") {
+      bench(argc, argv);
+      return 0;
+    }
+
+    if(std::string(argv[1]) == "--remarks") {
+      int arg = 2;
+      unsigned OptLevel = 2;
+      if(arg < argc && strncmp(argv[arg], "-O", 2) == 0)
+        OptLevel = strtoul(argv[arg++] + 2, 0, 10);
+      check_cond(arg < argc, "Error: --remarks needs a file.\n");
+      write_remarks(argv[arg], OptLevel, arg + 1 < argc ? argv[arg + 1] : "-");
+      return 0;
+    }
+  } catch(CompileError &E) {
+    printf("%s", E.what());
+    exit(0);
+  }
+
+  // --lazy [--export f,g,...] <file.d>, --specialize <file.d>
+  std::vector<std::string> Exported;
+  bool lazy = std::string(argv[1]) == "--lazy";
+  bool specialize = std::string(argv[1]) == "--specialize";
+  int arg = 1;
+  if(specialize && ++arg >= argc) {
+    printf("Error: --specialize needs a file.\n");
+    exit(0);
+  }
+  if(lazy) {
+    arg++;
+    if(arg + 1 < argc && std::string(argv[arg]) == "--export") {
+      std::string names = argv[arg + 1];
+      for(size_t start = 0, end; start <= names.size(); start = end + 1) {
+        end = names.find(',', start);
+        if(end == std::string::npos)
+          end = names.size();
+        if(end > start)
+          Exported.push_back(names.substr(start, end - start));
+      }
+      arg += 2;
+    }
+    if(arg >= argc) {
+      printf("Error: --lazy needs a file.\n");
+      exit(0);
+    }
+  }
+
+  // read at once, large sources are parsed on all cores
+  std::string source;
+  if(!read_file(argv[arg], source)) {
+    printf("Error: unable to open %s.\n", argv[arg]);
+    exit(0);
+  }
+
+  compile_and_print(source, outs(), lazy ? &Exported : 0, specialize);
+}
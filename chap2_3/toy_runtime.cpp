@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "toy_runtime.h"
+
+namespace {
+
+// One toy_parallel_for() call. The iterations are cut into Chunks of Grain
+// iterations, every chunk leaves its value in Results so they can be
+// combined in order no matter which thread ran it.
+struct Job {
+  toy_chunk_fn Chunk;
+  const int32_t *Env;
+  int64_t N, Grain;
+  std::vector<int32_t> Results;
+  std::atomic<int64_t> Pending;
+};
+
+// the chunks [Begin, End) of a job
+struct Task {
+  Job *J;
+  int64_t Begin, End;
+};
+
+struct Queue {
+  std::mutex Lock;
+  std::deque<Task> Tasks;
+};
+
+// A work-stealing pool: every thread takes its newest task from the back of
+// its own queue and steals the oldest, that is the largest, task from the
+// front of the others. Queue 0 is shared by the threads outside the pool.
+class Pool {
+public:
+  explicit Pool(unsigned Threads);
+  ~Pool();
+
+  unsigned size() const { return Queues.size(); }
+  // the queue of the calling thread
+  unsigned self() const;
+  void push(unsigned Self, const Task &T);
+  // Runs one task, false if there was none.
+  bool run_one(unsigned Self);
+
+private:
+  bool pop(unsigned Self, Task &T);
+  void run(unsigned Self, Task T);
+  void worker(unsigned Self);
+
+  std::vector<std::unique_ptr<Queue> > Queues;
+  std::vector<std::thread> Workers;
+  std::atomic<int64_t> Queued;
+  std::mutex Sleep_Lock;
+  std::condition_variable Wake;
+  bool Stop;
+};
+
+thread_local const Pool *Self_Pool = 0;
+thread_local unsigned Self_Index = 0;
+
+Pool::Pool(unsigned Threads) : Queued(0), Stop(false) {
+  for(unsigned idx = 0; idx < Threads; idx++)
+    Queues.push_back(std::unique_ptr<Queue>(new Queue));
+  for(unsigned idx = 1; idx < Threads; idx++)
+    Workers.push_back(std::thread(&Pool::worker, this, idx));
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> Guard(Sleep_Lock);
+    Stop = true;
+  }
+  Wake.notify_all();
+  for(size_t idx = 0; idx < Workers.size(); idx++)
+    Workers[idx].join();
+}
+
+unsigned Pool::self() const {
+  return Self_Pool == this ? Self_Index : 0;
+}
+
+void Pool::push(unsigned Self, const Task &T) {
+  {
+    std::lock_guard<std::mutex> Guard(Queues[Self]->Lock);
+    Queues[Self]->Tasks.push_back(T);
+  }
+  Queued++;
+  // taking the lock orders this against a worker about to sleep
+  { std::lock_guard<std::mutex> Guard(Sleep_Lock); }
+  Wake.notify_one();
+}
+
+bool Pool::pop(unsigned Self, Task &T) {
+  if(Queued.load() == 0)
+    return false;
+  for(unsigned idx = 0; idx < Queues.size(); idx++) {
+    unsigned Victim = (Self + idx) % Queues.size();
+    Queue &Q = *Queues[Victim];
+    std::lock_guard<std::mutex> Guard(Q.Lock);
+    if(Q.Tasks.empty())
+      continue;
+    if(Victim == Self) {
+      T = Q.Tasks.back();
+      Q.Tasks.pop_back();
+    } else {
+      T = Q.Tasks.front();
+      Q.Tasks.pop_front();
+    }
+    Queued--;
+    return true;
+  }
+  return false;
+}
+
+// Halves the task until one chunk is left, the halves go to the queue for
+// the others to steal.
+void Pool::run(unsigned Self, Task T) {
+  while(T.End - T.Begin > 1) {
+    int64_t Mid = T.Begin + (T.End - T.Begin) / 2;
+    Task Upper = {T.J, Mid, T.End};
+    push(Self, Upper);
+    T.End = Mid;
+  }
+
+  Job &J = *T.J;
+  int64_t Begin = T.Begin * J.Grain;
+  int64_t End = Begin + J.Grain < J.N ? Begin + J.Grain : J.N;
+  J.Results[T.Begin] = J.Chunk(J.Env, Begin, End);
+  J.Pending.fetch_sub(1, std::memory_order_release);
+}
+
+bool Pool::run_one(unsigned Self) {
+  Task T;
+  if(!pop(Self, T))
+    return false;
+  run(Self, T);
+  return true;
+}
+
+void Pool::worker(unsigned Self) {
+  Self_Pool = this;
+  Self_Index = Self;
+  while(true) {
+    if(run_one(Self))
+      continue;
+    std::unique_lock<std::mutex> Guard(Sleep_Lock);
+    Wake.wait(Guard, [this]() { return Stop || Queued.load() != 0; });
+    if(Stop)
+      return;
+  }
+}
+
+std::mutex Pool_Lock;
+std::unique_ptr<Pool> The_Pool;
+
+unsigned default_threads() {
+  if(const char *env = getenv("TOY_THREADS")) {
+    if(unsigned Threads = strtoul(env, 0, 10))
+      return Threads;
+  }
+  unsigned Threads = std::thread::hardware_concurrency();
+  return Threads ? Threads : 1;
+}
+
+Pool &get_pool() {
+  std::lock_guard<std::mutex> Guard(Pool_Lock);
+  if(!The_Pool)
+    The_Pool.reset(new Pool(default_threads()));
+  return *The_Pool;
+}
+
+// chunks per thread, enough for the stealing to even out uneven iterations
+const int64_t Chunks_Per_Thread = 8;
+
+}
+
+int32_t toy_parallel_for(toy_chunk_fn chunk, const int32_t *env, int64_t n,
+                         toy_combine_fn combine) {
+  if(n <= 0)
+    return 0;
+  Pool &P = get_pool();
+  if(P.size() == 1 || n == 1)
+    return chunk(env, 0, n);
+
+  int64_t Chunks = P.size() * Chunks_Per_Thread;
+  Job J;
+  J.Chunk = chunk;
+  J.Env = env;
+  J.N = n;
+  J.Grain = (n + Chunks - 1) / Chunks;
+  Chunks = (n + J.Grain - 1) / J.Grain;
+  J.Results.resize(Chunks);
+  J.Pending.store(Chunks);
+
+  // the caller helps out until its own chunks are done
+  unsigned Self = P.self();
+  Task All = {&J, 0, Chunks};
+  P.push(Self, All);
+  while(J.Pending.load(std::memory_order_acquire) != 0) {
+    if(!P.run_one(Self))
+      std::this_thread::yield();
+  }
+
+  int32_t Result = J.Results[0];
+  for(int64_t idx = 1; idx < Chunks; idx++)
+    Result = combine(Result, J.Results[idx]);
+  return Result;
+}
+
+void toy_runtime_set_threads(unsigned threads) {
+  std::lock_guard<std::mutex> Guard(Pool_Lock);
+  The_Pool.reset(new Pool(threads ? threads : default_threads()));
+}
+
+unsigned toy_runtime_threads(void) {
+  return get_pool().size();
+}
@@ -0,0 +1,35 @@
+#ifndef TOY_RUNTIME_H
+#define TOY_RUNTIME_H
+
+#include <stdint.h>
+
+// The runtime of 'parallel for', linked into the JIT and needed by the
+// objects from 'toy --stream --obj' (link them with build/libtoyrt.a and
+// -lpthread). Plain C, so it can be linked into programs of any language.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Computes the iterations [begin, end) of a loop, begin < end, and returns
+// their values combined in order.
+typedef int32_t (*toy_chunk_fn)(const int32_t *env, int64_t begin,
+                                int64_t end);
+typedef int32_t (*toy_combine_fn)(int32_t, int32_t);
+
+// Runs the 'n' iterations of a loop on all threads of the pool and returns
+// the values of all chunks combined in iteration order, 0 for no
+// iterations. The iterations are cut into chunks which idle threads steal
+// from each other; a loop within a loop runs on the same pool.
+int32_t toy_parallel_for(toy_chunk_fn chunk, const int32_t *env, int64_t n,
+                         toy_combine_fn combine);
+
+// The pool has one thread per core, or TOY_THREADS threads, the caller of
+// toy_parallel_for() included. It may be resized only while no loop runs.
+void toy_runtime_set_threads(unsigned threads);
+unsigned toy_runtime_threads(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+#include <sys/resource.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "toy.h"
+#include "toy_ast.h"
+#include "toy_stream.h"
+
+using namespace llvm;
+
+// the Makefile builds against LLVM 5, these changed later on
+#if LLVM_VERSION_MAJOR < 7
+static const sys::fs::OpenFlags Open_Flags = sys::fs::F_None;
+#define WRITE_BITCODE(M, OS) WriteBitcodeToFile(M, OS)
+#define ADD_OBJECT_PASSES(TM, PM, OS) \
+  (TM)->addPassesToEmitFile(PM, OS, TargetMachine::CGFT_ObjectFile)
+#else
+static const sys::fs::OpenFlags Open_Flags = sys::fs::OF_None;
+#define WRITE_BITCODE(M, OS) WriteBitcodeToFile(*(M), OS)
+#define ADD_OBJECT_PASSES(TM, PM, OS) \
+  (TM)->addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile)
+#endif
+
+// Moves the finished functions into a module of their own, together with
+// declarations of what they call from earlier chunks, and leaves
+// declarations of them behind for the items still to come. Keeping M down
+// to declarations also keeps writing a chunk independent of its size.
+static std::unique_ptr<Module> split_chunk(Module *M) {
+  std::unique_ptr<Module> Chunk(new Module(M->getModuleIdentifier(), 
+                                           M->getContext()));
+  Chunk->setSourceFileName(M->getSourceFileName());
+  Chunk->setTargetTriple(M->getTargetTriple());
+  Chunk->setDataLayout(M->getDataLayout());
+
+  std::vector<Function *> Defs;
+  for(Module::iterator F = M->begin(); F != M->end(); ++F) {
+    if(!F->isDeclaration())
+      Defs.push_back(&*F);
+  }
+  for(size_t idx = 0; idx < Defs.size(); idx++) {
+    Defs[idx]->removeFromParent();
+    Chunk->getFunctionList().push_back(Defs[idx]);
+  }
+
+  // whatever still has uses in M is called from the chunk
+  for(Module::iterator F = M->begin(); F != M->end(); ++F) {
+    if(F->use_empty())
+      continue;
+    Function *Decl = Function::Create(F->getFunctionType(), 
+                                      Function::ExternalLinkage, 
+                                      F->getName(), Chunk.get());
+    F->replaceAllUsesWith(Decl);
+  }
+
+  // the top-level expressions are not called by anything, the bodies of
+  // parallel loops only by their own function
+  for(size_t idx = 0; idx < Defs.size(); idx++) {
+    if(!Defs[idx]->getName().startswith("__anon_expr") && 
+       !Defs[idx]->hasLocalLinkage())
+      Function::Create(Defs[idx]->getFunctionType(), 
+                       Function::ExternalLinkage, Defs[idx]->getName(), M);
+  }
+  return Chunk;
+}
+
+static void write_chunk(Module *Chunk, Emit_Kind Kind, raw_ostream &IR_OS,
+                        TargetMachine *TM, const std::string &Output,
+                        size_t Index) {
+  if(Kind == EMIT_IR) {
+    // the declarations go to the end of the output, once
+    for(Module::iterator F = Chunk->begin(); F != Chunk->end(); ++F) {
+      if(!F->isDeclaration()) {
+        IR_OS << "\n";
+        F->print(IR_OS);
+      }
+    }
+    return;
+  }
+
+  std::string Path = Output + "." + std::to_string(Index) + 
+                     (Kind == EMIT_BITCODE ? ".bc" : ".o");
+  std::error_code EC;
+  raw_fd_ostream File(Path, EC, Open_Flags);
+  check_cond(!EC, "Error: unable to open " + Path + ": " + EC.message() + 
+                  "\n");
+
+  if(Kind == EMIT_BITCODE) {
+    WRITE_BITCODE(Chunk, File);
+  } else {
+    legacy::PassManager PM;
+    check_cond(!ADD_OBJECT_PASSES(TM, PM, File), 
+               "Error: the target cannot emit object files!\n");
+    PM.run(*Chunk);
+  }
+}
+
+Stream_Stats compileStreaming(Lexer &lex, Emit_Kind Kind,
+                              const std::string &Output,
+                              unsigned Chunk_Size) {
+  CompilerInstance CI;
+  Module *M = CI.codegen(std::vector<FunctionDefnAST *>());
+
+  std::unique_ptr<TargetMachine> TM;
+  if(Kind == EMIT_OBJECT) {
+    TM.reset(CI.createTargetMachine());
+    M->setTargetTriple(TM->getTargetTriple().str());
+    M->setDataLayout(TM->createDataLayout());
+  }
+
+  std::unique_ptr<raw_fd_ostream> IR_File;
+  if(Kind == EMIT_IR && Output != "-") {
+    std::error_code EC;
+    IR_File.reset(new raw_fd_ostream(Output, EC, Open_Flags));
+    check_cond(!EC, "Error: unable to open " + Output + ": " + 
+                    EC.message() + "\n");
+  }
+  raw_ostream &IR_OS = IR_File ? *IR_File : outs();
+  if(Kind == EMIT_IR)
+    IR_OS << "; ModuleID = '" << M->getModuleIdentifier() << "'\n"
+          << "source_filename = \"" << M->getSourceFileName() << "\"\n";
+
+  Stream_Stats Stats = {0, 0, 0};
+  // a written function looks like a declaration to FunctionDeclAST::code_gen
+  std::set<std::string> Defined;
+  size_t Pending = 0;
+  CI.startParse(lex);
+  while(FunctionDefnAST *Defn = CI.parseNext()) {
+    std::unique_ptr<FunctionDefnAST> Owner(Defn);
+    const std::string &Name = Defn->getDecl()->getName();
+    check_cond(Defined.insert(Name).second, 
+               "Error: redefinition of function " + Name + "!\n");
+    Defn->code_gen(CI);
+    Stats.Functions++;
+
+    if(++Pending == Chunk_Size) {
+      write_chunk(split_chunk(M).get(), Kind, IR_OS, TM.get(), Output, 
+                  Stats.Chunks++);
+      Pending = 0;
+    }
+  }
+  if(Pending != 0 || Stats.Chunks == 0)
+    write_chunk(split_chunk(M).get(), Kind, IR_OS, TM.get(), Output, 
+                Stats.Chunks++);
+
+  // what was called but never defined
+  if(Kind == EMIT_IR) {
+    for(Module::iterator F = M->begin(); F != M->end(); ++F) {
+      if(F->isDeclaration() && !Defined.count(F->getName().str())) {
+        IR_OS << "\n";
+        F->print(IR_OS);
+      }
+    }
+  }
+
+  rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+  Stats.Peak_RSS_KB = Usage.ru_maxrss;
+  return Stats;
+}
@@ -0,0 +1,31 @@
+#ifndef TOY_STREAM_H
+#define TOY_STREAM_H
+
+#include <stddef.h>
+#include <string>
+
+#include "toy.h"
+
+enum Emit_Kind {
+  EMIT_IR = 0,   // textual IR, one module
+  EMIT_BITCODE,  // one <Output>.<n>.bc per chunk
+  EMIT_OBJECT    // one <Output>.<n>.o per chunk
+};
+
+struct Stream_Stats {
+  size_t Functions;
+  size_t Chunks;
+  long Peak_RSS_KB;
+};
+
+// Compiles the input one top-level item at a time and writes the generated
+// functions out every 'Chunk_Size' items. The written bodies are dropped
+// from the module and only declarations stay for later calls, so memory
+// does not grow with the number of functions. Textual IR goes to the file
+// 'Output' ("-" for stdout), bitcode and objects to one file per chunk, to
+// be linked together.
+Stream_Stats compileStreaming(Lexer &lex, Emit_Kind Kind,
+                              const std::string &Output,
+                              unsigned Chunk_Size = 256);
+
+#endif
@@ -2,6 +2,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "LoopNest.h"
  
 using namespace llvm;
  
@@ -16,29 +17,11 @@ struct FunctionCount : public FunctionPass {
     LoopInfo *LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
     errs() << "Function: " << F.getName() << "\n";
     for (Loop *L : *LI) {
-      countBlocksInloop(L, 0);
+      printLoopNest(L, 0);
     }
     return false;
   }
 
-  void countBlocksInloop(Loop *L, unsigned nest) {
-    unsigned numBlocks = 0;
-    Loop::block_iterator bb;
-
-    for (bb = L->block_begin(); bb != L->block_end(); ++bb) {
-      numBlocks++;
-    }
-    for (int idx = 0; idx < nest * 2; idx++) {
-      errs() << " ";
-    }
-    errs() << "Loop level " << nest << " has " << numBlocks << " Blocks\n";
-    std::vector<Loop *> subLoops = L->getSubLoops();
-    Loop::iterator j;
-    for (j = subLoops.begin(); j != subLoops.end(); j++) {
-      countBlocksInloop(*j, nest + 1);
-    }
-  }
-
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<LoopInfoWrapperPass>();
   }
@@ -0,0 +1,34 @@
+#ifndef LOOPNEST_H
+#define LOOPNEST_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Prints the loop nest the way FunCount does, one "Loop level <n> has <m>
+// Blocks" line per loop indented by its depth. 'Details' is called right
+// after the line of every loop, so other passes can add to the report.
+template <typename Callback>
+void printLoopNest(llvm::Loop *L, unsigned nest, Callback Details) {
+  unsigned numBlocks = 0;
+  llvm::Loop::block_iterator bb;
+
+  for (bb = L->block_begin(); bb != L->block_end(); ++bb) {
+    numBlocks++;
+  }
+  for (unsigned idx = 0; idx < nest * 2; idx++) {
+    llvm::errs() << " ";
+  }
+  llvm::errs() << "Loop level " << nest << " has " << numBlocks << " Blocks\n";
+  Details(L, nest);
+  std::vector<llvm::Loop *> subLoops = L->getSubLoops();
+  llvm::Loop::iterator j;
+  for (j = subLoops.begin(); j != subLoops.end(); j++) {
+    printLoopNest(*j, nest + 1, Details);
+  }
+}
+
+inline void printLoopNest(llvm::Loop *L, unsigned nest) {
+  printLoopNest(L, nest, [](llvm::Loop *, unsigned) {});
+}
+
+#endif
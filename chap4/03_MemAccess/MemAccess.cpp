@@ -0,0 +1,142 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "LoopNest.h"
+
+using namespace llvm;
+
+// a stride of at least this many bytes uses one cache line per access
+static cl::opt<unsigned> LargeStride("ma-large-stride", cl::init(64),
+    cl::desc("stride in bytes from which an access is flagged"));
+
+namespace {
+enum AccessKind { Invariant, UnitStride, ConstantStride, Irregular };
+
+struct MemAccess : public FunctionPass {
+  static char ID;
+  LoopInfo *LI;
+  ScalarEvolution *SE;
+  const DataLayout *DL;
+
+  MemAccess() : FunctionPass(ID) {}
+
+  bool runOnFunction(Function &F) override {
+    LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    DL = &F.getParent()->getDataLayout();
+    errs() << "Function: " << F.getName() << "\n";
+    for (Loop *L : *LI) {
+      printLoopNest(L, 0, [this](Loop *L, unsigned nest) {
+        printAccesses(L, nest);
+      });
+    }
+    return false;
+  }
+
+  // Classifies the address of an access against the loop. 'Stride' gets the
+  // byte distance between two iterations when it is constant.
+  AccessKind classify(Value *Ptr, Loop *L, uint64_t Size, int64_t &Stride) {
+    const SCEV *S = SE->getSCEV(Ptr);
+    Stride = 0;
+    if (SE->isLoopInvariant(S, L)) {
+      return Invariant;
+    }
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+    if (!AR || AR->getLoop() != L || !AR->isAffine()) {
+      return Irregular;
+    }
+    const SCEVConstant *Step =
+        dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+    if (!Step) {
+      return Irregular;
+    }
+    Stride = Step->getAPInt().getSExtValue();
+    uint64_t Abs = Stride < 0 ? -Stride : Stride;
+    return Abs == Size ? UnitStride : ConstantStride;
+  }
+
+  // The loads and stores whose innermost loop is L, with the bytes of cache
+  // they bring in per iteration.
+  void printAccesses(Loop *L, unsigned nest) {
+    std::string indent(nest * 2 + 2, ' ');
+    static const char *KindName[] = {"invariant", "unit stride",
+                                     "constant stride", "irregular"};
+    uint64_t bytes = 0;
+    unsigned flagged = 0;
+
+    Loop::block_iterator bb;
+    for (bb = L->block_begin(); bb != L->block_end(); ++bb) {
+      if (LI->getLoopFor(*bb) != L) {
+        continue;
+      }
+      for (Instruction &I : **bb) {
+        Value *Ptr;
+        Type *Ty;
+        if (LoadInst *Load = dyn_cast<LoadInst>(&I)) {
+          Ptr = Load->getPointerOperand();
+          Ty = Load->getType();
+        } else if (StoreInst *Store = dyn_cast<StoreInst>(&I)) {
+          Ptr = Store->getPointerOperand();
+          Ty = Store->getValueOperand()->getType();
+        } else {
+          continue;
+        }
+
+        uint64_t Size = DL->getTypeStoreSize(Ty);
+        int64_t Stride;
+        AccessKind Kind = classify(Ptr, L, Size, Stride);
+        uint64_t Abs = Stride < 0 ? -Stride : Stride;
+        bool Flag = Kind == Irregular ||
+                    (Kind == ConstantStride && Abs >= LargeStride);
+        // an invariant address stays in cache, a gather or a large stride
+        // costs a whole line
+        if (Kind == UnitStride) {
+          bytes += Size;
+        } else if (Kind == ConstantStride) {
+          bytes += Abs < LargeStride ? Abs : (uint64_t)LargeStride;
+        } else if (Kind == Irregular) {
+          bytes += LargeStride;
+        }
+        flagged += Flag;
+
+        errs() << indent << I.getOpcodeName() << " " << Size << " bytes";
+        if (I.getDebugLoc()) {
+          errs() << " at line " << I.getDebugLoc().getLine();
+        }
+        errs() << ": " << KindName[Kind];
+        if (Kind == ConstantStride) {
+          errs() << " " << Stride << " bytes";
+        }
+        errs() << (Flag ? "  <-- poor locality" : "") << "\n";
+      }
+    }
+
+    errs() << indent << "~" << bytes << " bytes per iteration";
+    if (unsigned Trips = SE->getSmallConstantTripCount(L)) {
+      errs() << ", " << Trips << " iterations";
+    }
+    if (flagged) {
+      errs() << ", " << flagged << " accesses with poor locality";
+    }
+    errs() << "\n";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.setPreservesAll();
+  }
+};
+}
+
+char MemAccess::ID = 0;
+static RegisterPass<MemAccess> X("ma", "classify the memory accesses of loops",
+                                 false /* Only looks at CFG */,
+                                 true /* Analysis Pass */);
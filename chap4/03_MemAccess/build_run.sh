@@ -0,0 +1,7 @@
+cd ./build
+rm -rf *
+cmake ../
+make
+cd ../
+clang -O1 -g -S -emit-llvm exam_00.c -o exam_00.ll
+opt -load ./build/libMemAccess.so -ma exam_00.ll -disable-output
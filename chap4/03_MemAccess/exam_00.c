@@ -0,0 +1,25 @@
+#define N 512
+
+int a[N][N], b[N][N], idx[N];
+
+int main(int argc, char **argv) {
+  int i, j, t = 0;
+
+  /* row by row: unit stride */
+  for(i = 0; i < N; i++) {
+    for(j = 0; j < N; j++) {
+      a[i][j] = b[i][j] + argc;
+    }
+  }
+  /* column by column: a stride of one row */
+  for(j = 0; j < N; j++) {
+    for(i = 0; i < N; i++) {
+      t += a[i][j];
+    }
+  }
+  /* gather through an index array, idx[argc] does not change */
+  for(i = 0; i < N; i++) {
+    t += b[0][idx[i]] * idx[argc];
+  }
+  return t;
+}
@@ -0,0 +1,216 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> CostJSON("cost-json", cl::value_desc("file"),
+    cl::desc("also write the ranking as JSON to this file"));
+
+namespace {
+struct LoopCost {
+  std::string Function;
+  std::string Header;
+  unsigned Line;
+  unsigned Depth;
+  unsigned Trips;
+  double Cycles;
+};
+
+struct FunctionCost {
+  std::string Name;
+  double Cycles;
+};
+
+// Estimates the cycles a function takes per call without running it: the
+// reciprocal throughput of every instruction from TargetTransformInfo,
+// times how often its block runs. Block frequencies come from
+// BlockFrequencyInfo, with the loop estimates replaced by the constant trip
+// counts that ScalarEvolution knows.
+struct CostModel : public FunctionPass {
+  static char ID;
+  std::vector<FunctionCost> Functions;
+  std::vector<LoopCost> Loops;
+
+  CostModel() : FunctionPass(ID) {}
+
+  static double instructionCost(const TargetTransformInfo &TTI,
+                                Instruction &I) {
+    auto Cost = TTI.getInstructionCost(
+        &I, TargetTransformInfo::TCK_RecipThroughput);
+#if LLVM_VERSION_MAJOR >= 12
+    if (!Cost.isValid()) {
+      return 1;
+    }
+    return *Cost.getValue();
+#else
+    // -1 stands for unknown
+    return Cost < 0 ? 1 : Cost;
+#endif
+  }
+
+  // Trip count over what BlockFrequencyInfo assumed for the loop, 1 where
+  // the trip count is not known.
+  static double tripScale(Loop *L, BlockFrequencyInfo &BFI,
+                          ScalarEvolution &SE) {
+    unsigned Trips = SE.getSmallConstantTripCount(L);
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Trips || !Preheader) {
+      return 1;
+    }
+    double Entered = BFI.getBlockFreq(Preheader).getFrequency();
+    double Header = BFI.getBlockFreq(L->getHeader()).getFrequency();
+    if (Entered == 0 || Header == 0) {
+      return 1;
+    }
+    return Trips / (Header / Entered);
+  }
+
+  bool runOnFunction(Function &F) override {
+    const TargetTransformInfo &TTI =
+        getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    BlockFrequencyInfo &BFI =
+        getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
+    ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+    std::map<Loop *, double> Scale;
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      Scale[L] = tripScale(L, BFI, SE);
+    }
+
+    double Entry = BFI.getEntryFreq();
+    std::map<Loop *, double> LoopCycles;
+    double Total = 0;
+    for (BasicBlock &BB : F) {
+      double Freq = BFI.getBlockFreq(&BB).getFrequency() / Entry;
+      for (Loop *L = LI.getLoopFor(&BB); L; L = L->getParentLoop()) {
+        Freq *= Scale[L];
+      }
+
+      double Cost = 0;
+      for (Instruction &I : BB) {
+        Cost += instructionCost(TTI, I);
+      }
+      double Cycles = Cost * Freq;
+      Total += Cycles;
+      for (Loop *L = LI.getLoopFor(&BB); L; L = L->getParentLoop()) {
+        LoopCycles[L] += Cycles;
+      }
+    }
+
+    errs() << "Function: " << F.getName() << " ~"
+           << formatv("{0:F1}", Total) << " cycles per call\n";
+    Functions.push_back({F.getName().str(), Total});
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      LoopCost LC;
+      LC.Function = F.getName().str();
+      // the header as an operand: its name, or its slot number when the
+      // names are discarded
+      raw_string_ostream Header(LC.Header);
+      L->getHeader()->printAsOperand(Header, false);
+      Header.flush();
+      LC.Line = 0;
+      if (DebugLoc DL = L->getStartLoc()) {
+        LC.Line = DL.getLine();
+      }
+      LC.Depth = L->getLoopDepth();
+      LC.Trips = SE.getSmallConstantTripCount(L);
+      LC.Cycles = LoopCycles[L];
+      Loops.push_back(LC);
+    }
+    return false;
+  }
+
+  static std::string describe(const LoopCost &LC) {
+    std::string S = LC.Function + " loop " + LC.Header;
+    if (LC.Line) {
+      S += " at line " + std::to_string(LC.Line);
+    }
+    S += " (depth " + std::to_string(LC.Depth);
+    if (LC.Trips) {
+      S += ", " + std::to_string(LC.Trips) + " iterations";
+    }
+    return S + ")";
+  }
+
+  json::Value toJSON() const {
+    json::Array Funcs, LoopList;
+    for (const FunctionCost &FC : Functions) {
+      Funcs.push_back(json::Object{{"name", FC.Name}, {"cycles", FC.Cycles}});
+    }
+    for (const LoopCost &LC : Loops) {
+      LoopList.push_back(json::Object{{"function", LC.Function},
+                                      {"header", LC.Header},
+                                      {"line", LC.Line},
+                                      {"depth", LC.Depth},
+                                      {"trip_count", LC.Trips},
+                                      {"cycles", LC.Cycles}});
+    }
+    return json::Object{{"functions", std::move(Funcs)},
+                        {"loops", std::move(LoopList)}};
+  }
+
+  // Everything is known once the last function is done: rank and report.
+  bool doFinalization(Module &M) override {
+    std::stable_sort(Functions.begin(), Functions.end(),
+                     [](const FunctionCost &A, const FunctionCost &B) {
+                       return A.Cycles > B.Cycles;
+                     });
+    std::stable_sort(Loops.begin(), Loops.end(),
+                     [](const LoopCost &A, const LoopCost &B) {
+                       return A.Cycles > B.Cycles;
+                     });
+
+    errs() << "Functions by estimated cycles per call:\n";
+    for (const FunctionCost &FC : Functions) {
+      errs() << formatv("  {0,14:F1}  {1}\n", FC.Cycles, FC.Name);
+    }
+    errs() << "Loops by estimated cycles per call of their function:\n";
+    for (const LoopCost &LC : Loops) {
+      errs() << formatv("  {0,14:F1}  {1}\n", LC.Cycles, describe(LC));
+    }
+
+    if (!CostJSON.empty()) {
+      std::error_code EC;
+      raw_fd_ostream OS(CostJSON, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "cannot write " << CostJSON << ": " << EC.message() << "\n";
+      } else {
+        OS << formatv("{0:2}", toJSON()) << "\n";
+      }
+    }
+    Functions.clear();
+    Loops.clear();
+    return false;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<BlockFrequencyInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.setPreservesAll();
+  }
+};
+}
+
+char CostModel::ID = 0;
+static RegisterPass<CostModel> X("cm", "estimate the cycles of functions and loops",
+                                 false /* Only looks at CFG */,
+                                 true /* Analysis Pass */);
@@ -0,0 +1,7 @@
+cd ./build
+rm -rf *
+cmake ../
+make
+cd ../
+clang -O2 -g -S -emit-llvm exam_00.c -o exam_00.ll
+opt -load ./build/libCostModel.so -cm -cost-json=exam_00.json exam_00.ll -disable-output
@@ -0,0 +1,42 @@
+#define N 256
+
+float a[N][N], b[N][N], c[N][N];
+
+/* N^3 multiply-adds */
+void matmul(void) {
+  int i, j, k;
+  for(i = 0; i < N; i++) {
+    for(j = 0; j < N; j++) {
+      float s = 0;
+      for(k = 0; k < N; k++) {
+        s += a[i][k] * b[k][j];
+      }
+      c[i][j] = s;
+    }
+  }
+}
+
+/* N^2 divisions */
+void scale(float d) {
+  int i, j;
+  for(i = 0; i < N; i++) {
+    for(j = 0; j < N; j++) {
+      c[i][j] = c[i][j] / d;
+    }
+  }
+}
+
+/* the trip count is only known at run time */
+int sum(int *p, int n) {
+  int i, s = 0;
+  for(i = 0; i < n; i++) {
+    s += p[i];
+  }
+  return s;
+}
+
+int main(int argc, char **argv) {
+  matmul();
+  scale(argc);
+  return sum((int *)c, argc);
+}
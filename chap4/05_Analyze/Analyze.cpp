@@ -0,0 +1,154 @@
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LegacyPassNameParser.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PluginLoader.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/MC/TargetRegistry.h"
+#else
+#include "llvm/Support/TargetRegistry.h"
+#endif
+#include <sys/resource.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// Runs the function passes of the chap4 plugins like 'opt -load', but over
+// a lazily loaded module: only the bodies of the selected functions are
+// read from the bitcode, one at a time, and each is dropped again once the
+// passes are done with it.
+//
+//   analyze -load ./build/libInstCount.so -oc [-func=f,g] [-func-regex=re] x.bc
+
+static cl::opt<std::string> InputFilename(cl::Positional, cl::Required,
+    cl::desc("<input bitcode>"));
+
+static cl::list<std::string> FuncNames("func", cl::CommaSeparated,
+    cl::value_desc("name,..."), cl::desc("analyze only these functions"));
+
+static cl::opt<std::string> FuncRegex("func-regex", cl::value_desc("regex"),
+    cl::desc("analyze only the functions matching the regex"));
+
+static cl::list<const PassInfo *, bool, PassNameParser> PassList(
+    cl::desc("Analyses available:"));
+
+static bool selected(const Function &F, Regex *Re) {
+  if (FuncNames.empty() && !Re) {
+    return true;
+  }
+  for (const std::string &Name : FuncNames) {
+    if (F.getName() == Name) {
+      return true;
+    }
+  }
+  return Re && Re->match(F.getName());
+}
+
+// Passes asking for TargetTransformInfo get the one of the host, if the
+// bitcode is for it.
+static TargetMachine *createTargetMachine(Module &M) {
+  std::string Err;
+  std::string Triple = M.getTargetTriple();
+  if (Triple.empty()) {
+    return nullptr;
+  }
+  const Target *T = TargetRegistry::lookupTarget(Triple, Err);
+  if (!T) {
+    return nullptr;
+  }
+  return T->createTargetMachine(Triple, sys::getHostCPUName(), "",
+                                TargetOptions(), None);
+}
+
+int main(int argc, char **argv) {
+  llvm_shutdown_obj Shutdown;
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeAnalysis(Registry);
+  InitializeNativeTarget();
+  cl::ParseCommandLineOptions(argc, argv, "lazy analysis driver\n");
+
+  std::unique_ptr<Regex> Re;
+  if (!FuncRegex.empty()) {
+    Re.reset(new Regex(FuncRegex));
+    std::string Err;
+    if (!Re->isValid(Err)) {
+      errs() << argv[0] << ": bad -func-regex: " << Err << "\n";
+      return 1;
+    }
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+  LLVMContext Context;
+  SMDiagnostic Diag;
+  // the function bodies and their metadata stay in the file until needed
+  std::unique_ptr<Module> M = getLazyIRFileModule(InputFilename, Diag, Context,
+                                                  true);
+  if (!M) {
+    Diag.print(argv[0], errs());
+    return 1;
+  }
+
+  std::unique_ptr<TargetMachine> TM(createTargetMachine(*M));
+  legacy::FunctionPassManager FPM(M.get());
+  if (TM) {
+    FPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+  }
+  for (const PassInfo *PI : PassList) {
+    Pass *P = PI->getNormalCtor()();
+    if (P->getPassKind() != PT_Function) {
+      errs() << argv[0] << ": -" << PI->getPassArgument()
+             << " is not a function pass\n";
+      delete P;
+      return 1;
+    }
+    FPM.add(P);
+  }
+
+  unsigned Total = 0, Analyzed = 0;
+  FPM.doInitialization();
+  for (Function &F : *M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    Total++;
+    if (!selected(F, Re.get())) {
+      continue;
+    }
+    if (Error E = F.materialize()) {
+      logAllUnhandledErrors(std::move(E), errs(), argv[0] + std::string(": "));
+      return 1;
+    }
+    FPM.run(F);
+    // the body is not needed any more, only the declaration stays
+    F.deleteBody();
+    Analyzed++;
+  }
+  FPM.doFinalization();
+
+  rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+  double Secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count();
+  errs() << "analyze: " << Analyzed << " of " << Total << " functions, "
+         << format("%.1f", Secs * 1e3) << " ms, peak RSS "
+         << Usage.ru_maxrss << " KB\n";
+  return 0;
+}
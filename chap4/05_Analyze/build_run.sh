@@ -0,0 +1,8 @@
+cd ./build
+rm -rf *
+cmake ../
+make
+cd ../
+cd ../01_InstCount && sh ./build_run.sh > /dev/null && cd ../05_Analyze
+./build/analyze -load ../01_InstCount/build/libInstCount.so -oc -func=func ../01_InstCount/exam_00.bc
+./build/analyze -load ../01_InstCount/build/libInstCount.so -oc -func-regex='^f' ../01_InstCount/exam_00.bc